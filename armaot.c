@@ -0,0 +1,522 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "armemu.h"
+
+/* Ahead-of-time translator: walks the control flow graph of each guest
+   function from its entry point, following b/bl/bx, and writes a C file
+   with one host function per guest function. Guest registers and flags
+   become locals. The semantics are those of armemu's interpreter, so a
+   translated function returns the same values and counters as armemu().
+   Anything the interpreter executes but this translator does not know
+   (VFP/NEON, conditional data processing, writes to pc) makes the whole
+   guest function fall back to the interpreter. */
+
+#define MAX_INSTS 4096
+#define MAX_FUNCS 64
+
+/* Assembly functions to translate */
+int quadratic_a(int a, int b, int c, int d);
+int sum_array_a(int *array, int n);
+int find_max_a(int *array, int n);
+int fib_iter_a(int n);
+int fib_rec_a(int n);
+int strlen_a(char *s);
+int dot_product_a(int *a, int *b, int n);
+
+struct aot_root {
+    char *name;
+    unsigned int *func;
+};
+
+struct aot_root aot_roots[] = {
+    {"quadratic_a", (unsigned int *) quadratic_a},
+    {"sum_array_a", (unsigned int *) sum_array_a},
+    {"find_max_a", (unsigned int *) find_max_a},
+    {"fib_iter_a", (unsigned int *) fib_iter_a},
+    {"fib_rec_a", (unsigned int *) fib_rec_a},
+    {"strlen_a", (unsigned int *) strlen_a},
+    {"dot_product_a", (unsigned int *) dot_product_a},
+};
+
+#define AOT_NROOTS (sizeof(aot_roots) / sizeof(aot_roots[0]))
+
+struct aot_function {
+    char *root;                 // symbol the function is named after
+    unsigned int root_addr;
+    unsigned int addr;          // entry point
+    bool ok;                    // every reachable instruction can be translated
+    char *why;
+    int n;
+    unsigned int insts[MAX_INSTS];  // reachable instruction addresses, sorted
+};
+
+struct aot_program {
+    int n;
+    struct aot_function funcs[MAX_FUNCS];
+};
+
+char *cond_expr[] = {
+    "z == 1", "z == 0", "c == 1", "c == 0", "n == 1", "n == 0", "v == 1", "v == 0",
+    "c == 1 && z == 0", "c == 0 || z == 1", "n == v", "n != v",
+    "z == 0 && n == v", "z == 1 || n != v", "1", "0"
+};
+
+unsigned int branch_target(unsigned int addr, unsigned int iw)
+{
+    int offset = iw & 0xFFFFFF;
+
+    if ((iw >> 23) & 0b1)
+        offset = offset | 0xFF000000;
+    return addr + offset * 4 + 8;
+}
+
+// returns NULL if the instruction can be translated, else the reason
+char *untranslatable(unsigned int iw)
+{
+    unsigned int cond = (iw >> 28) & 0xF;
+    unsigned int opcode;
+    unsigned int rd;
+    unsigned int rn;
+
+    switch(classify_inst(iw))
+    {
+        case INST_UNDEFINED:
+        case INST_NEON:
+        case INST_VFP:
+            return "instruction not supported";
+        case INST_BX:
+            return cond == 14 ? NULL : "conditional bx";
+        case INST_BRANCH:
+            if (cond == 15)
+                return "blx";
+            return (((iw >> 24) & 0b1) && cond != 14) ? "conditional bl" : NULL;
+        case INST_MUL:
+            if (cond != 14)
+                return "conditional mul";
+            return (((iw >> 16) & 0xF) == PC || (iw & 0xF) == PC || ((iw >> 8) & 0xF) == PC) ? "mul with pc" : NULL;
+        case INST_DATA_PROCESSING:
+            opcode = (iw >> 21) & 0xF;
+            rd = (iw >> 12) & 0xF;
+            rn = (iw >> 16) & 0xF;
+            if (cond != 14)
+                return "conditional data processing";
+            if (opcode != 2 && opcode != 4 && opcode != 10 && opcode != 13)
+                return "data processing opcode";
+            if ((opcode != 10 && rd == PC) || rn == PC || (!((iw >> 25) & 0b1) && (iw & 0xF) == PC))
+                return "data processing with pc";
+            return NULL;
+        case INST_SINGLE_DATA_TRANSFER:
+            if (cond != 14)
+                return "conditional load/store";
+            if (((iw >> 25) & 0b1) && (iw & 0xF) == PC)
+                return "pc offset register";
+            if (!((iw >> 20) & 0b1) && ((iw >> 12) & 0xF) == PC)
+                return "store of pc";
+            return NULL;
+        case INST_BLOCK_DATA_TRANSFER:
+            if ((iw & 0xFFFF) == 0 || ((iw >> 22) & 0b1) || cond == 15)
+                return "ldm/stm form";
+            if (((iw >> 16) & 0xF) == PC)
+                return "ldm/stm on pc";
+            if (!((iw >> 20) & 0b1) && (iw & (1 << PC)))
+                return "stm of pc";
+            return NULL;
+    }
+    return "instruction not supported";
+}
+
+bool contains(struct aot_function *f, unsigned int addr)
+{
+    int i;
+
+    for (i = 0; i < f->n; i++) {
+        if (f->insts[i] == addr)
+            return true;
+    }
+    return false;
+}
+
+int find_function(struct aot_program *prog, unsigned int addr)
+{
+    int i;
+
+    for (i = 0; i < prog->n; i++) {
+        if (prog->funcs[i].addr == addr)
+            return i;
+    }
+    return -1;
+}
+
+int add_function(struct aot_program *prog, char *root, unsigned int root_addr, unsigned int addr)
+{
+    struct aot_function *f;
+
+    if (find_function(prog, addr) >= 0)
+        return find_function(prog, addr);
+    if (prog->n == MAX_FUNCS)
+        return -1;
+
+    f = &prog->funcs[prog->n];
+    f->root = root;
+    f->root_addr = root_addr;
+    f->addr = addr;
+    f->ok = true;
+    f->why = NULL;
+    f->n = 0;
+    return prog->n++;
+}
+
+int compare_addr(const void *a, const void *b)
+{
+    unsigned int x = *((unsigned int *) a);
+    unsigned int y = *((unsigned int *) b);
+
+    return (x > y) - (x < y);
+}
+
+/* Finds every instruction reachable from the entry point. bl targets are
+   added as functions of their own. */
+void discover(struct aot_program *prog, int index)
+{
+    struct aot_function *f = &prog->funcs[index];
+    unsigned int work[2 * MAX_INSTS + 2];
+    unsigned int addr;
+    unsigned int iw;
+    unsigned int cond;
+    int nwork = 0;
+    int kind;
+
+    work[nwork++] = f->addr;
+    while (nwork > 0) {
+        addr = work[--nwork];
+        if (contains(f, addr))
+            continue;
+        if (f->n == MAX_INSTS) {
+            f->ok = false;
+            f->why = "too many instructions";
+            return;
+        }
+        f->insts[f->n++] = addr;
+
+        iw = *((unsigned int *) addr);
+        cond = (iw >> 28) & 0xF;
+        kind = classify_inst(iw);
+        f->why = untranslatable(iw);
+        if (f->why != NULL) {
+            f->ok = false;
+            return;
+        }
+
+        if (kind == INST_BX)
+            continue;
+        if (kind == INST_BRANCH && ((iw >> 24) & 0b1)) {
+            if (add_function(prog, f->root, f->root_addr, branch_target(addr, iw)) < 0) {
+                f->ok = false;
+                f->why = "too many functions";
+                return;
+            }
+            f = &prog->funcs[index];
+            work[nwork++] = addr + 4;
+            continue;
+        }
+        if (kind == INST_BRANCH) {
+            work[nwork++] = branch_target(addr, iw);
+            if (cond != 14)
+                work[nwork++] = addr + 4;
+            continue;
+        }
+        if (((kind == INST_SINGLE_DATA_TRANSFER && ((iw >> 12) & 0xF) == PC) || (kind == INST_BLOCK_DATA_TRANSFER && (iw & (1 << PC))))
+            && ((iw >> 20) & 0b1) && cond == 14)
+            continue;   //return by loading pc
+        work[nwork++] = addr + 4;
+    }
+    qsort(f->insts, f->n, sizeof(unsigned int), compare_addr);
+}
+
+// prints a signed offset as a C identifier fragment
+void print_offset(FILE *out, int offset)
+{
+    if (offset < 0)
+        fprintf(out, "m%x", -offset);
+    else
+        fprintf(out, "%x", offset);
+}
+
+void print_name(FILE *out, struct aot_function *f)
+{
+    fprintf(out, "aot_%s_", f->root);
+    print_offset(out, f->addr - f->root_addr);
+}
+
+void print_label(FILE *out, struct aot_function *f, unsigned int addr)
+{
+    fprintf(out, "L_");
+    print_offset(out, addr - f->root_addr);
+}
+
+void emit_instruction(FILE *out, struct aot_program *prog, struct aot_function *f, unsigned int addr)
+{
+    unsigned int iw = *((unsigned int *) addr);
+    unsigned int cond = (iw >> 28) & 0xF;
+    unsigned int rd = (iw >> 12) & 0xF;
+    unsigned int rn = (iw >> 16) & 0xF;
+    unsigned int opcode;
+    unsigned int list;
+    unsigned int target;
+    unsigned int n;
+    unsigned int i;
+    unsigned int k;
+    int off = addr - f->root_addr;
+    int callee;
+    char op2[16];
+    char base[32];
+    char offset[16];
+
+    print_label(out, f, addr);
+    fprintf(out, ": /* %08x */\n", iw);
+
+    switch(classify_inst(iw))
+    {
+        case INST_BX:
+            fprintf(out, "    COUNT(AOT_BRANCH_TAKEN);\n");
+            fprintf(out, "    AOT_SPILL();\n    regs[15] = r%d;\n    return;\n", iw & 0xF);
+            return;
+
+        case INST_BRANCH:
+            target = branch_target(addr, iw);
+            if ((iw >> 24) & 0b1) {
+                callee = find_function(prog, target);
+                fprintf(out, "    COUNT(AOT_BRANCH_TAKEN);\n");
+                fprintf(out, "    r14 = base + %d;\n", off + 4);
+                fprintf(out, "    AOT_SPILL();\n");
+                fprintf(out, "    regs[15] = base + %d;\n", (int) (target - f->root_addr));
+                if (callee < 0 || !prog->funcs[callee].ok) {
+                    fprintf(out, "    return;\n");
+                    return;
+                }
+                fprintf(out, "    ");
+                print_name(out, &prog->funcs[callee]);
+                fprintf(out, "(regs, flags, counts);\n");
+                fprintf(out, "    AOT_RELOAD();\n");
+                fprintf(out, "    if (regs[15] != base + %d)\n        return;\n", off + 4);
+            } else {
+                fprintf(out, "    if (%s) {\n        COUNT(AOT_BRANCH_TAKEN);\n        goto ", cond_expr[cond]);
+                print_label(out, f, target);
+                fprintf(out, ";\n    }\n");
+                if (cond != 14)
+                    fprintf(out, "    COUNT(AOT_BRANCH_NOT_TAKEN);\n");
+            }
+            break;
+
+        case INST_MUL:
+            fprintf(out, "    r%d = r%d * r%d;\n", (iw >> 16) & 0xF, iw & 0xF, (iw >> 8) & 0xF);
+            fprintf(out, "    COUNT(AOT_COMPUTATION);\n");
+            break;
+
+        case INST_DATA_PROCESSING:
+            opcode = (iw >> 21) & 0xF;
+            if ((iw >> 25) & 0b1)
+                sprintf(op2, "%uu", iw & 0xFF);
+            else
+                sprintf(op2, "r%d", iw & 0xF);
+            switch(opcode)
+            {
+                case 2: fprintf(out, "    r%d = r%d - %s;\n", rd, rn, op2); break;
+                case 4: fprintf(out, "    r%d = r%d + %s;\n", rd, rn, op2); break;
+                case 10: fprintf(out, "    aot_cmp(r%d, %s, &n, &z, &c, &v);\n", rn, op2); break;
+                case 13: fprintf(out, "    r%d = %s;\n", rd, op2); break;
+            }
+            fprintf(out, "    COUNT(AOT_COMPUTATION);\n");
+            break;
+
+        case INST_SINGLE_DATA_TRANSFER:
+            if (rn == PC)
+                sprintf(base, "(base + %d)", off + 8);
+            else
+                sprintf(base, "r%d", rn);
+            if ((iw >> 25) & 0b1)
+                sprintf(offset, "r%d", iw & 0xF);
+            else
+                sprintf(offset, "%uu", iw & 0xFFF);
+            fprintf(out, "    oa = %s %c %s;\n", base, ((iw >> 23) & 0b1) ? '+' : '-', offset);
+            fprintf(out, "    ta = %s;\n", ((iw >> 24) & 0b1) ? "oa" : base);
+            if (!((iw >> 24) & 0b1) || ((iw >> 21) & 0b1))
+                fprintf(out, "    r%d = oa;\n", rn);
+            fprintf(out, "    COUNT(AOT_MEMORY);\n    COUNT(AOT_MEMORY_WORDS);\n");
+            if ((iw >> 22) & 0b1) {
+                if ((iw >> 20) & 0b1)
+                    fprintf(out, "    r%d = *((unsigned char *) ta);\n", rd);
+                else
+                    fprintf(out, "    *((unsigned char *) ta) = r%d;\n", rd);
+            } else if ((iw >> 20) & 0b1) {
+                if (rd == PC) {
+                    fprintf(out, "    AOT_SPILL();\n    regs[15] = *((unsigned int *) ta) & ~1;\n    return;\n");
+                    return;
+                }
+                fprintf(out, "    r%d = *((unsigned int *) ta);\n", rd);
+            } else {
+                fprintf(out, "    *((unsigned int *) ta) = r%d;\n", rd);
+            }
+            break;
+
+        case INST_BLOCK_DATA_TRANSFER:
+            list = iw & 0xFFFF;
+            n = __builtin_popcount(list);
+            fprintf(out, "    if (%s) {\n", cond_expr[cond]);
+            fprintf(out, "        oa = r%d;\n", rn);
+            if ((iw >> 23) & 0b1)
+                fprintf(out, "        ta = oa + %d;\n", ((iw >> 24) & 0b1) ? 4 : 0);
+            else
+                fprintf(out, "        ta = oa - %d;\n", ((iw >> 24) & 0b1) ? 4 * n : 4 * n - 4);
+            if (((iw >> 20) & 0b1) && ((iw >> 21) & 0b1))
+                fprintf(out, "        r%d = oa %c %d;\n", rn, ((iw >> 23) & 0b1) ? '+' : '-', 4 * n);
+            for (i = 0, k = 0; i < NREGS; i++) {
+                if (!(list & (1 << i)))
+                    continue;
+                if ((iw >> 20) & 0b1)
+                    fprintf(out, "        r%d = ((unsigned int *) ta)[%d];\n", i, k);
+                else
+                    fprintf(out, "        ((unsigned int *) ta)[%d] = r%d;\n", k, i);
+                k++;
+            }
+            if (!((iw >> 20) & 0b1) && ((iw >> 21) & 0b1))
+                fprintf(out, "        r%d = oa %c %d;\n", rn, ((iw >> 23) & 0b1) ? '+' : '-', 4 * n);
+            fprintf(out, "        COUNT(AOT_MEMORY);\n");
+            for (i = 0; i < n; i++) {
+                fprintf(out, "        COUNT(AOT_MEMORY_WORDS);\n");
+            }
+            if (((iw >> 20) & 0b1) && (list & (1 << PC)))
+                fprintf(out, "        AOT_SPILL();\n        regs[15] = r15 & ~1;\n        return;\n");
+            fprintf(out, "    } else {\n        COUNT(AOT_MEMORY);\n    }\n");
+            break;
+    }
+}
+
+void emit_function(FILE *out, struct aot_program *prog, struct aot_function *f)
+{
+    int i;
+
+    fprintf(out, "\nvoid ");
+    print_name(out, f);
+    fprintf(out, "(unsigned int *regs, int *flags, unsigned int *counts)\n{\n");
+    fprintf(out, "    unsigned int r0 = regs[0], r1 = regs[1], r2 = regs[2], r3 = regs[3];\n");
+    fprintf(out, "    unsigned int r4 = regs[4], r5 = regs[5], r6 = regs[6], r7 = regs[7];\n");
+    fprintf(out, "    unsigned int r8 = regs[8], r9 = regs[9], r10 = regs[10], r11 = regs[11];\n");
+    fprintf(out, "    unsigned int r12 = regs[12], r13 = regs[13], r14 = regs[14], r15 = 0;\n");
+    fprintf(out, "    int n = flags[0], z = flags[1], c = flags[2], v = flags[3];\n");
+    fprintf(out, "    unsigned int base = regs[15] - %d;   // guest address of %s\n", (int) (f->addr - f->root_addr), f->root);
+    fprintf(out, "    unsigned int oa, ta;\n\n");
+
+    for (i = 0; i < f->n; i++) {
+        emit_instruction(out, prog, f, f->insts[i]);
+
+        // fall through to the next instruction if it is not the next one
+        // emitted, discovery added it if this instruction can fall through
+        if ((i + 1 == f->n || f->insts[i + 1] != f->insts[i] + 4) && contains(f, f->insts[i] + 4)) {
+            fprintf(out, "    goto ");
+            print_label(out, f, f->insts[i] + 4);
+            fprintf(out, ";\n");
+        }
+    }
+    fprintf(out, "}\n");
+}
+
+void emit_program(FILE *out, struct aot_program *prog, bool counters)
+{
+    struct aot_function *f;
+    int i;
+    int r;
+
+    fprintf(out, "/* Generated by armaot, do not edit */\n\n");
+    fprintf(out, "#include \"armaot.h\"\n\n");
+    fprintf(out, "#pragma GCC diagnostic ignored \"-Wunused-label\"\n");
+    fprintf(out, "#pragma GCC diagnostic ignored \"-Wunused-variable\"\n");
+    fprintf(out, "#pragma GCC diagnostic ignored \"-Wunused-but-set-variable\"\n\n");
+    if (counters)
+        fprintf(out, "#define COUNT(i) counts[i]++\n\n");
+    else
+        fprintf(out, "#define COUNT(i)\n\n");
+
+    fprintf(out, "#define AOT_SPILL() do { \\\n");
+    for (r = 0; r < 15; r++) {
+        fprintf(out, "    regs[%d] = r%d; \\\n", r, r);
+    }
+    fprintf(out, "    flags[0] = n; flags[1] = z; flags[2] = c; flags[3] = v; \\\n} while (0)\n\n");
+    fprintf(out, "#define AOT_RELOAD() do { \\\n");
+    for (r = 0; r < 15; r++) {
+        fprintf(out, "    r%d = regs[%d]; \\\n", r, r);
+    }
+    fprintf(out, "    n = flags[0]; z = flags[1]; c = flags[2]; v = flags[3]; \\\n} while (0)\n\n");
+
+    // same flag computation as set_cpsr_flags
+    fprintf(out, "static void aot_cmp(unsigned int a, unsigned int b, int *n, int *z, int *c, int *v)\n{\n");
+    fprintf(out, "    unsigned int result = a - b;\n\n");
+    fprintf(out, "    *n = result >> 31;\n    *z = (result == 0);\n    *c = (a >= b);\n");
+    fprintf(out, "    *v = ((a ^ b) & (a ^ result)) >> 31;\n}\n\n");
+
+    for (i = 0; i < prog->n; i++) {
+        f = &prog->funcs[i];
+        if (!f->ok) {
+            fprintf(out, "/* %s+%d left to the interpreter: %s */\n", f->root, (int) (f->addr - f->root_addr), f->why);
+            continue;
+        }
+        fprintf(out, "void ");
+        print_name(out, f);
+        fprintf(out, "(unsigned int *regs, int *flags, unsigned int *counts);\n");
+    }
+
+    for (i = 0; i < prog->n; i++) {
+        if (prog->funcs[i].ok)
+            emit_function(out, prog, &prog->funcs[i]);
+    }
+
+    fprintf(out, "\nstruct aot_entry aot_table[] = {\n");
+    for (i = 0; i < prog->n; i++) {
+        f = &prog->funcs[i];
+        if (!f->ok)
+            continue;
+        fprintf(out, "    {\"%s\", %d, ", f->root, (int) (f->addr - f->root_addr));
+        print_name(out, f);
+        fprintf(out, "},\n");
+    }
+    fprintf(out, "    {0, 0, 0}\n};\n\nint aot_table_size = sizeof(aot_table) / sizeof(aot_table[0]) - 1;\n");
+}
+
+int main(int argc, char **argv)
+{
+    struct aot_program *prog;
+    bool counters = false;
+    char c[] = "-c";
+    int i;
+
+    // -c keeps the guest instruction counters in the generated code
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], c) == 0)
+            counters = true;
+    }
+
+    prog = malloc(sizeof(struct aot_program));
+    prog->n = 0;
+    for (i = 0; i < AOT_NROOTS; i++) {
+        add_function(prog, aot_roots[i].name, (unsigned int) aot_roots[i].func, (unsigned int) aot_roots[i].func);
+    }
+    // discovery appends bl targets, which are discovered in turn
+    for (i = 0; i < prog->n; i++) {
+        discover(prog, i);
+    }
+
+    // a function that calls one the interpreter must run is still fine, the
+    // call returns to the interpreter
+    emit_program(stdout, prog, counters);
+
+    for (i = 0; i < prog->n; i++) {
+        fprintf(stderr, "%s+%d: %s\n", prog->funcs[i].root, (int) (prog->funcs[i].addr - prog->funcs[i].root_addr),
+                prog->funcs[i].ok ? "translated" : prog->funcs[i].why);
+    }
+
+    free(prog);
+    return 0;
+}
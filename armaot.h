@@ -0,0 +1,41 @@
+/* Interface between armemu and the code armaot generates */
+
+#ifndef ARMAOT_H
+#define ARMAOT_H
+
+#define AOT_MAX_ENTRIES 256
+#define AOT_HASH_SIZE 1024  // power of two, at least twice AOT_MAX_ENTRIES
+
+/* Indices into the counts[] array passed to translated code */
+#define AOT_COMPUTATION 0
+#define AOT_MEMORY 1
+#define AOT_MEMORY_WORDS 2
+#define AOT_BRANCH_TAKEN 3
+#define AOT_BRANCH_NOT_TAKEN 4
+#define AOT_NCOUNTS 5
+
+/* A translated function runs from regs[15] until it returns to its caller,
+   or until it reaches code it could not translate. Either way it writes all
+   registers and flags (n, z, c, v) back and leaves the next guest PC in
+   regs[15], so the interpreter can carry on from there. */
+typedef void (*aot_func)(unsigned int *regs, int *flags, unsigned int *counts);
+
+/* The generated object exports aot_table[] and aot_table_size */
+struct aot_entry {
+    char *name;     // symbol the entry point is relative to
+    int offset;     // byte offset of the entry point from the symbol
+    aot_func fn;
+};
+
+/* Entry points of a loaded object, resolved to guest addresses. hash is
+   an open addressed table of entry index + 1 by address, 0 when empty, so
+   the interpreter can check every PC without scanning the entries. */
+struct aot_code {
+    void *handle;   // the loaded object, closed by aot_unload
+    int n;
+    unsigned int addr[AOT_MAX_ENTRIES];
+    aot_func fn[AOT_MAX_ENTRIES];
+    unsigned short hash[AOT_HASH_SIZE];
+};
+
+#endif
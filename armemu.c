@@ -3,12 +3,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
-
-#define NREGS 16
-#define STACK_SIZE 1024
-#define SP 13
-#define LR 14
-#define PC 15
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <dlfcn.h>
+#include <setjmp.h>
+#include <signal.h>
+
+#include "armemu.h"
+#include "armtelem.h"
 
 /* Assembly functions to emulate */
 int quadratic_a(int a, int b, int c, int d);
@@ -23,86 +28,8 @@ int fib_rec_a(int n);
 int fib_rec_c(int n);
 int strlen_a(char *s);
 int strlen_c(char *s);
-
-/* The complete machine state */
-struct arm_state {
-    unsigned int regs[NREGS];
-    unsigned char stack[STACK_SIZE];
-    int n_flag;
-    int z_flag;
-    int c_flag;
-    int v_flag;
-    unsigned int computation_count;
-    unsigned int memory_count;
-    unsigned int branch_taken;
-    unsigned int branch_not_taken;
-};
-
-struct cache_slot {
-    unsigned int v;
-    unsigned int tag;
-};
-
-struct direct_mapped_cache {
-    struct cache_slot slots[STACK_SIZE];
-    int cache_hit;
-    int cache_miss;
-    int requests;
-    int size;
-};
-
-/* Initialize an arm_state struct with a function pointer and arguments */
-void arm_state_init(struct arm_state *as, struct direct_mapped_cache *cache, unsigned int *func, unsigned int arg0, unsigned int arg1, unsigned int arg2, unsigned int arg3)
-{
-    int i;
-    
-    // Zero out all arm state
-    for (i = 0; i < NREGS; i++) {
-        as->regs[i] = 0;
-    }
-    
-    // Zero out CPSR
-    as->n_flag = 0;
-    as->z_flag = 0;
-    as->c_flag = 0;
-    as->v_flag = 0;
-    
-    // Zero out the stack
-    for (i = 0; i < STACK_SIZE; i++) {
-        as->stack[i] = 0;
-    }
-    
-    // Set the PC to point to the address of the function to emulate
-    as->regs[PC] = (unsigned int) func;
-    
-    // Set the SP to the top of the stack (the stack grows down)
-    as->regs[SP] = (unsigned int) &as->stack[STACK_SIZE];
-    
-    // Initialize LR to 0, this will be used to determine when the function has called bx lr
-    as->regs[LR] = 0;
-    
-    // Initialize the first 4 arguments
-    as->regs[0] = arg0;
-    as->regs[1] = arg1;
-    as->regs[2] = arg2;
-    as->regs[3] = arg3;
-    
-    // Initialize the instruction counts
-    as->computation_count = 0;
-    as->memory_count = 0;
-    as->branch_taken = 0;
-    as->branch_not_taken = 0;
-    
-    // Initialzies the Cache
-    cache->cache_hit = 0;
-    cache->cache_miss = 0;
-    cache->requests = 0;
-    
-    for (i = 0; i < STACK_SIZE; i++) {
-        cache->slots[i].v = 0;
-        cache->slots[i].tag = 0;
-    }
-}
+int dot_product_a(int *a, int *b, int n);
+int dot_product_c(int *a, int *b, int n);
 
 void arm_state_print(struct arm_state *as)
 {
@@ -126,6 +53,7 @@ void instruction_count_print(struct arm_state *state)
     printf("\t%0.0f%% of total instructions\n", 100 * ((float)state->computation_count/(float)total));
     printf("Total Memory Instructions Executed: %d\n", state->memory_count);
     printf("\t%0.0f%% of total instructions\n", ((float)state->memory_count/(float)total));
+    printf("Total Memory Words Transferred: %d\n", state->memory_words);
     printf("Total Branch Instructions Executed: %d\n", (state->branch_taken+state->branch_not_taken));
     printf("Total Branch Instructions Taken: %d\n", state->branch_taken);
     printf("\t%0.0f%% of branch instructions\n", 100 * ((float)state->branch_taken/(float)(state->branch_taken+state->branch_not_taken)));
@@ -146,393 +74,76 @@ void cache_output(struct direct_mapped_cache *cache)
 
 }
 
-void set_cpsr_flags(struct arm_state *state, unsigned int a, unsigned int b)
-{
-    int result, as, bs;
-    long long al, bl;
-    
-    as = (int) a;
-    bs = (int) b;
-    al = (long long) a;
-    bl = (long long) b;
-    
-    result = as - bs;
-    
-    state->n_flag = (result < 0);
-    
-    state->z_flag = (result == 0);
-    
-    state->c_flag = (b > a);
-    
-    state->v_flag = 0;
-    if ((as > 0) && (bs < 0)) {
-        if ((al + (-1 * bl)) > 0x7FFFFFFF) {
-            state->v_flag = 1;
-        }
-    } else if ((as < 0) && (bs > 0)) {
-        if (((-1 * al) + bl) > 0x80000000) {
-            state->v_flag = 1;
-        }
-    }
-}
-
-// computes the slot that the address would go in the cache
-int get_slot(int size, unsigned int addr)
-{
-    return((addr >> 2) & (size -1));
-}
-           
-unsigned int get_tag(int size, unsigned int addr)
-{
-    int log2 = 0;
-    while(size) {
-        size = size >> 1;
-        log2 = log2 + 1;
-    }
-    return (addr >> (2 + log2)) & ((2 + log2) -1);
-}
-
-void simulate_cache(struct direct_mapped_cache *cache, unsigned int addr)
-{
-    int addr_slot;
-    unsigned int tag;
-    
-    //update cache requests
-    cache->requests = cache->requests + 1;
-    
-    addr_slot = get_slot(cache->size, addr);
-    tag = get_tag(cache->size, addr);
-    
-    int v = cache->slots[addr_slot].v;
-    int slot_tag = cache->slots[addr_slot].tag;
-        
-    if(v) {
-        if(tag == slot_tag){
-            cache->cache_hit++;
-        } else {
-            cache->cache_miss++;
-            cache->slots[addr_slot].tag = tag;
-            cache->slots[addr_slot].v = 1;
-        }
-    } else {  //v == 0 so update the slot and increment the miss
-        cache->cache_miss++;
-        cache->slots[addr_slot].tag = tag;
-        cache->slots[addr_slot].v = 1;
-    }
-}
-
-bool is_data_processing_inst(unsigned int iw)
-{
-    return ((iw >> 26) & 0b11) == 0;
-}
-
-void armemu_data_processing(struct arm_state *state)
-{
-    unsigned int opcode;
-    unsigned int iw;
-    unsigned int rm_val;
-    unsigned int rd;
-    unsigned int rn;
-    unsigned int i_bit;
-    
-    iw = *((unsigned int *) state->regs[PC]);
-    
-    opcode = (iw >> 21) & 0xF;
-    i_bit = (iw >> 25) & 0b1;
-    
-    rd = (iw >> 12) & 0xF;
-    rn = (iw >> 16) & 0xF;
-    
-    if (i_bit == 1)
-        rm_val = iw & 0xFF;
-    else
-        rm_val = state->regs[(iw & 0xF)];
-    
-    switch(opcode)
-    {
-        case 2: //sub
-            state->regs[rd] = state->regs[rn] - rm_val;
-            break;
-        case 4: //add
-            state->regs[rd] = state->regs[rn] + rm_val;
-            break;
-        case 10: //cmp
-            set_cpsr_flags(state, state->regs[rn], rm_val);
-            break;
-        case 13: //mov
-            state->regs[rd] = rm_val;
-            break;
-    }
-    
-    state->computation_count++;
-    state->regs[PC] = state->regs[PC] + 4;
-}
-
-bool is_mul_inst(unsigned int iw)
-{
-    unsigned int op;
-    unsigned int op2;
-    
-    op = (iw >> 22) & 0b111111;
-    op2 = (iw >> 4) & 0xF;
-    
-    return (op == 0) && (op2 == 0b1001);
-    
-}
-
-void armemu_mul(struct arm_state *state)
-{
-    unsigned int iw;
-    unsigned int rd;
-    unsigned int rm;
-    unsigned int rs;
-    
-    iw = *((unsigned int *) state->regs[PC]);
-    
-    rd = (iw >> 16) & 0xF;
-    rm = iw & 0xF;
-    rs = (iw >> 8) & 0xF;
-    
-    state->regs[rd] = state->regs[rm] * state->regs[rs];
-    
-    state->computation_count++;
-    state->regs[PC] = state->regs[PC] + 4;
-}
-
-bool is_branch_inst(unsigned int iw)
-{
-    unsigned int opcode;
-    // Strictly for checking if bl or b
-    opcode = (iw >> 25) & 0b111 ;
-    
-    return (opcode == 0b101);
-}
-
-bool condition_flags(struct arm_state *state, unsigned int iw)
-{
-    unsigned int cond = (iw >> 28) & 0xF;
-    
-    switch(cond)
-    {
-        case 0: //beq
-            //takes the branch as the Z flag is set
-            return(state->z_flag == 1);
-            
-        case 1: //bne
-            return(state->z_flag == 0);  //takes the branch
-            
-        case 11: //blt
-            //n not equal to v
-            return (state->n_flag != state->v_flag);
-            
-        case 12: //bgt
-            //z clear and n equals v
-            return(state->z_flag == 0 && (state->n_flag == state-> v_flag));
-    }
-}
-
-// branch or branch and link w/ bne / beq
-void armemu_branch(struct arm_state *state)
-{
-    unsigned int iw;
-    unsigned int link;
-    int offset;
-    int significant_bit;
-    int byte_address;
-    int mask = 0xFF000000; //32 bit's of 1s
-
-    iw = *((unsigned int *) state->regs[PC]);
-    
-    link = (iw >> 24) & 0b1;
-    offset = iw & 0xFFFFFF;
-    significant_bit = (iw >> 23) & 0b1;
-    
-    if(condition_flags(state, iw)){
-        state->branch_taken += 1;
-        
-        if(significant_bit)
-        {
-            //adjust offset to be a 2's comp byte address by sign extending the offset
-             offset = offset | mask;
-             offset = (~ offset) + 1;
-             offset = offset * -1;
-        }
-        //add new offset to PC
-        byte_address = offset * 4;
-        int adjust = byte_address + 8;
-        
-        if(link)   //branch with link
-            state->regs[LR] = state->regs[PC] + 4;     //set LR to PC + 4 (the next instruction)
-            state->regs[PC] = state->regs[PC] + adjust;
-    }
-    else {
-        state->branch_not_taken++;
-        state->regs[PC] += 4;
-    }
-}
-
-bool is_bx_inst(unsigned int iw)
-{
-    unsigned int bx_code;
-    
-    bx_code = (iw >> 4) & 0x00FFFFFF;
-    
-    return (bx_code == 0b000100101111111111110001);
-}
-
-void armemu_bx(struct arm_state *state)
-{
-    unsigned int iw;
-    unsigned int rn;
-    
-    iw = *((unsigned int *) state->regs[PC]);
-    rn = iw & 0b1111;
-    
-    state->branch_taken++;
-    state->regs[PC] = state->regs[rn];
-}
-
-bool is_single_data_transfer_inst(unsigned int iw)
-{
-    unsigned int op;
-    
-    op = (iw >> 26) & 0b11;
-    
-    return op == 0b01;
-}
-
-void armemu_single_data_transfer(struct arm_state *state)
-{
-    unsigned int iw;
-    unsigned int rd;
-    unsigned int rn;
-    unsigned int rm_val;
-    unsigned int i_bit;
-    unsigned int b_bit;
-    unsigned int l_bit;
-    unsigned int target_address;
-    
-    iw = *((unsigned int *) state->regs[PC]);
-    
-    rd = (iw >> 12) & 0xF;
-    rn = (iw >> 16) & 0xF;
-    
-    i_bit = (iw >> 25) & 0b1;
-    b_bit = (iw >> 22) & 0b1;
-    l_bit = (iw >> 20) & 0b1;
-    
-    //Check i bit
-    if (i_bit == 1)
-    {
-        rm_val = state->regs[(iw & 0xF)];
-        target_address = state->regs[rn] + rm_val;
-    }
-    else
-        target_address = state->regs[rn] + (iw & 0xFFF);
-    
-    //Check b bit
-    if (b_bit == 1) {
-    // Check l bit
-        if (l_bit == 1) {
-            state->regs[rd] = (unsigned int)*((char *)target_address); //ldrb
-        }
-    }
-    else {
-    //Check l bit
-        if (l_bit == 1) {
-            state->regs[rd] = *((unsigned int *) target_address); //ldr
-        }
-        else {
-            *((unsigned int *) target_address) = state->regs[rd]; //str
-        }
-    }
-    state->memory_count++;
-    state->regs[PC] = state->regs[PC] + 4;
-}
-
-void armemu_one(struct arm_state *state, struct direct_mapped_cache *cache)
-{
-    unsigned int iw;
-    iw = *((unsigned int *) state->regs[PC]);
-    simulate_cache(cache, state->regs[PC]);
-    
-    if (is_bx_inst(iw)){
-        armemu_bx(state);
-    } else if (is_branch_inst(iw)) {
-            armemu_branch(state);
-    } else if (is_mul_inst(iw)) {
-        armemu_mul(state);
-    } else if (is_data_processing_inst(iw)) {
-        armemu_data_processing(state);
-    } else if (is_single_data_transfer_inst(iw)) {
-        armemu_single_data_transfer(state);
-    }
-}
-
-unsigned int armemu(struct arm_state *state, struct direct_mapped_cache *cache)
+// a machine with the default stack and a c_size slot cache
+struct armemu_machine *new_machine(int c_size)
 {
-    //Execute instructions until PC = 0
-    //This happens when bx lr is issued and lr is 0
-    while (state->regs[PC] != 0) {
-        armemu_one(state, cache);
+    struct armemu_config config;
+    struct armemu_machine *m;
+    
+    armemu_config_default(&config);
+    config.cache_size = c_size;
+    m = armemu_create(NULL, &config);
+    if (m == NULL) {
+        perror("armemu_create");
+        exit(1);
     }
-    return state->regs[0];
+    return m;
 }
 
 void execute_sum_array(int c_size)
 {
-    struct arm_state state;
-    struct direct_mapped_cache cache;
+    struct armemu_machine *machine = new_machine(c_size);
+    struct arm_state *state = &machine->state;
+    struct direct_mapped_cache *cache = &machine->cache;
     unsigned int c_result;
     unsigned int a_result;
     unsigned int emu_result;
     int test[] = {1, 2, 3, 4};
     
-    cache.size=c_size;
-    arm_state_init(&state, &cache, (unsigned int *) sum_array_a,(unsigned int)test, 4, 0, 0);
+    arm_state_init(state, cache, (unsigned int *) sum_array_a,(unsigned int)test, 4, 0, 0);
     c_result = sum_array_c(test, 4);
     a_result = sum_array_a(test, 4);
-    emu_result = armemu(&state, &cache);
+    emu_result = armemu(state, cache);
     
     printf("\n-- Executing Sum Array Functions --\n");
     printf("quadratic_c(1, 2, 3, 4) = %d\n", c_result);
     printf("quadratic_a(1, 2, 3, 4) = %d\n", a_result);
     printf("armemu(quadratic_a(1, 2, 3, 4)) = %d\n", emu_result);
 
-    instruction_count_print(&state);
-    cache_output(&cache);
+    instruction_count_print(state);
+    cache_output(cache);
 
     int test2[] = {4, 0, 3, 0, 5};
     
-    arm_state_init(&state, &cache, (unsigned int *) sum_array_a,(unsigned int)test2, 5, 0, 0);
+    arm_state_init(state, cache, (unsigned int *) sum_array_a,(unsigned int)test2, 5, 0, 0);
     
     c_result = sum_array_c(test2, 5);
     a_result = sum_array_a(test2, 5);
-    emu_result = armemu(&state, &cache);
+    emu_result = armemu(state, cache);
     
     printf("\n");
     printf("sum_array_c(4, 0, 3, 0, 5) = %d\n", c_result);
     printf("sum_array_a(4, 0, 3, 0, 5) = %d\n", a_result);
     printf("armemu(sum_array_a(4, 0, 3, 0, 5)) = %d\n", emu_result);
 
-    instruction_count_print(&state);
-    cache_output(&cache);
+    instruction_count_print(state);
+    cache_output(cache);
 
     int test3[] = {9, 0, -5, -1, 12};
     
-    arm_state_init(&state, &cache, (unsigned int *) sum_array_a,(unsigned int)test3, 5, 0, 0);
+    arm_state_init(state, cache, (unsigned int *) sum_array_a,(unsigned int)test3, 5, 0, 0);
     
     c_result = sum_array_c(test3, 5);
     a_result = sum_array_a(test3, 5);
-    emu_result = armemu(&state, &cache);
+    emu_result = armemu(state, cache);
     
     printf("\n");
     printf("sum_array_c(9, 0, -5, -1, 12) = %d\n", c_result);
     printf("sum_array_a(9, 0, -5, -1, 12) = %d\n", a_result);
     printf("armemu(sum_array_a(9, 0, -5, -1, 12)) = %d\n", emu_result);
 
-    instruction_count_print(&state);
-    cache_output(&cache);
+    instruction_count_print(state);
+    cache_output(cache);
 
     int test4[1000];
 
@@ -540,74 +151,76 @@ void execute_sum_array(int c_size)
         test4[i] = i;
     }
     
-    arm_state_init(&state, &cache, (unsigned int *) sum_array_a,(unsigned int)test4, 1000, 0, 0);
+    arm_state_init(state, cache, (unsigned int *) sum_array_a,(unsigned int)test4, 1000, 0, 0);
     
     c_result = sum_array_c(test4, 1000);
     a_result = sum_array_a(test4, 1000);
-    emu_result = armemu(&state, &cache);
+    emu_result = armemu(state, cache);
     
     printf("\n");
     printf("sum_array_c(0-999) = %d\n", c_result);
     printf("sum_array_a(0-999) = %d\n", a_result);
     printf("armemu(sum_array_a(0-999)) = %d\n", emu_result);
     
-    instruction_count_print(&state);
-    cache_output(&cache);
+    instruction_count_print(state);
+    cache_output(cache);
+    
+    armemu_destroy(machine);
 }
 
 void execute_find_max(int c_size)
 {
-    struct arm_state state;
-    struct direct_mapped_cache cache;
+    struct armemu_machine *machine = new_machine(c_size);
+    struct arm_state *state = &machine->state;
+    struct direct_mapped_cache *cache = &machine->cache;
     unsigned int c_result;
     unsigned int a_result;
     unsigned int emu_result;
     
     int test[] = {10, 2, 6, 3, 5};
     
-    cache.size=c_size;
-    arm_state_init(&state, &cache, (unsigned int *) find_max_a,(unsigned int) test, 5, 0, 0);
+    arm_state_init(state, cache, (unsigned int *) find_max_a,(unsigned int) test, 5, 0, 0);
     c_result = find_max_c(test, 5);
     a_result = find_max_a(test, 5);
-    emu_result = armemu(&state, &cache);
+    emu_result = armemu(state, cache);
     
     printf("\n-- Executing Find Max Functions --\n");
     printf("find_max_c(10, 2, 6, 3, 5) = %d\n", c_result);
     printf("find_max_a(10, 2, 6, 3, 5) = %d\n", a_result);
     printf("armemu(find_max_a(10, 2, 6, 3, 5)) = %d\n", emu_result);
 
-    instruction_count_print(&state);
-    cache_output(&cache);
+    instruction_count_print(state);
+    cache_output(cache);
 
     int test2[] = {-4, 3, 7, -2, 12};
     
-    arm_state_init(&state, &cache, (unsigned int *) find_max_a,(unsigned int) test2, 5, 0, 0);
+    arm_state_init(state, cache, (unsigned int *) find_max_a,(unsigned int) test2, 5, 0, 0);
     
     c_result = find_max_c(test2, 5);
     a_result = find_max_a(test2, 5);
-    emu_result = armemu(&state, &cache);
+    emu_result = armemu(state, cache);
     
     printf("find_max_c(-4, 3, 7, -2, 12) = %d\n", c_result);
     printf("find_max_a(-4, 3, 7, -2, 12) = %d\n", a_result);
     printf("armemu(find_max_a(-4, 3, 7, -2, 12)) = %d\n", emu_result);
 
-    instruction_count_print(&state);
-    cache_output(&cache);
+    instruction_count_print(state);
+    cache_output(cache);
 
     int test3[] = {0, -5, 0, 3, 1};
     
-    arm_state_init(&state, &cache, (unsigned int *) find_max_a,(unsigned int) test3, 5, 0, 0);
+    arm_state_init(state, cache, (unsigned int *) find_max_a,(unsigned int) test3, 5, 0, 0);
     
     c_result = find_max_c(test3, 5);
     a_result = find_max_a(test3, 5);
-    emu_result = armemu(&state, &cache);
+    emu_result = armemu(state, cache);
     
     printf("find_max_c(0, -5, 0, 3, 1) = %d\n", c_result);
     printf("find_max_a(0, -5, 0, 3, 1) = %d\n", a_result);
     printf("armemu(find_max_a(0, -5, 0, 3, 1)) = %d\n", emu_result);
 
-    instruction_count_print(&state);
-    cache_output(&cache);
+    instruction_count_print(state);
+    cache_output(cache);
 
     int test4[1000];
 
@@ -615,86 +228,91 @@ void execute_find_max(int c_size)
         test4[i] = i;
     }
     
-    arm_state_init(&state, &cache, (unsigned int *) find_max_a,(unsigned int) test4, 1000, 0, 0);
+    arm_state_init(state, cache, (unsigned int *) find_max_a,(unsigned int) test4, 1000, 0, 0);
     
     c_result = find_max_c(test4, 1000);
     a_result = find_max_a(test4, 1000);
-    emu_result = armemu(&state, &cache);
+    emu_result = armemu(state, cache);
     
     printf("find_max_c(0-999) = %d\n", c_result);
     printf("find_max_a(0-999) = %d\n", a_result);
     printf("armemu(find_max_a(0-999)) = %d\n", emu_result);
     
-    instruction_count_print(&state);
-    cache_output(&cache);    
+    instruction_count_print(state);
+    cache_output(cache);    
+    
+    armemu_destroy(machine);
 }
 
 void execute_quadratic(int c_size)
 {
-    struct arm_state state;
-    struct direct_mapped_cache cache;
+    struct armemu_machine *machine = new_machine(c_size);
+    struct arm_state *state = &machine->state;
+    struct direct_mapped_cache *cache = &machine->cache;
     unsigned int c_result;
     unsigned int a_result;
     unsigned int emu_result;
     
-    cache.size=c_size;
-    arm_state_init(&state, &cache, (unsigned int *) quadratic_a, 1, 2, 3, 4);
+    arm_state_init(state, cache, (unsigned int *) quadratic_a, 1, 2, 3, 4);
     c_result = quadratic_c(1, 2, 3, 4);
     a_result = quadratic_a(1, 2, 3, 4);
-    emu_result = armemu(&state, &cache);
+    emu_result = armemu(state, cache);
     
     printf("-- Executing Quadratic Functions --\n");
     printf("quadratic_c(1, 2, 3, 4) = %d\n", c_result);
     printf("quadratic_a(1, 2, 3, 4) = %d\n", a_result);
     printf("armemu(quadratic_a(1, 2, 3, 4)) = %d\n", emu_result);
 
-    instruction_count_print(&state);
-    cache_output(&cache);
+    instruction_count_print(state);
+    cache_output(cache);
 
-    arm_state_init(&state, &cache, (unsigned int *) quadratic_a, 7, 0, 4, -1);
+    arm_state_init(state, cache, (unsigned int *) quadratic_a, 7, 0, 4, -1);
     
     c_result = quadratic_c(7, 0, 4, -1);
     a_result = quadratic_a(7, 0, 4, -1);
-    emu_result = armemu(&state, &cache);
+    emu_result = armemu(state, cache);
     
     printf("quadratic_c(7, 0, 4, -1) = %d\n", c_result);
     printf("quadratic_a(7, 0, 4, -1) = %d\n", a_result);
     printf("armemu(quadratic_a(7, 0, 4, -1)) = %d\n", emu_result);
 
-    instruction_count_print(&state);
-    cache_output(&cache);
+    instruction_count_print(state);
+    cache_output(cache);
 
-    arm_state_init(&state, &cache, (unsigned int *) quadratic_a, -10, 13, 0, 6);
+    arm_state_init(state, cache, (unsigned int *) quadratic_a, -10, 13, 0, 6);
     
     c_result = quadratic_c(-10, 13, 0, 6);
     a_result = quadratic_a(-10, 13, 0, 6);
-    emu_result = armemu(&state, &cache);
+    emu_result = armemu(state, cache);
     
     printf("quadratic_c(-10, 13, 0, 6) = %d\n", c_result);
     printf("quadratic_a(-10, 13, 0, 6) = %d\n", a_result);
     printf("armemu(quadratic_a(-10, 13, 0, 6)) = %d\n", emu_result);
 
-    instruction_count_print(&state);
-    cache_output(&cache);
+    instruction_count_print(state);
+    cache_output(cache);
 
-    arm_state_init(&state, &cache, (unsigned int *) quadratic_a, -5, -8, -23, -1);
+    arm_state_init(state, cache, (unsigned int *) quadratic_a, -5, -8, -23, -1);
     
     c_result = quadratic_c(-5, -8, -23, -1);
     a_result = quadratic_a(-5, -8, -23, -1);
-    emu_result = armemu(&state, &cache);
+    emu_result = armemu(state, cache);
 
     printf("quadratic_c(-5, -8, -23, -1) = %d\n", c_result);
     printf("quadratic_a(-5, -8, -23, -1) = %d\n", a_result);
     printf("armemu(quadratic_a(-5, -8, -23, -1)) = %d\n", emu_result);
     
-    instruction_count_print(&state);
-    cache_output(&cache);
+    instruction_count_print(state);
+    cache_output(cache);
+    
+    armemu_destroy(machine);
 }
 
 void execute_fib_iter(int c_size)
 {
-    struct arm_state state;
-    struct direct_mapped_cache cache;
+    struct armemu_machine *machine = new_machine(c_size);
+    struct arm_state *state = &machine->state;
+    struct direct_mapped_cache *cache = &machine->cache;
     unsigned int c_result;
     unsigned int a_result;
     unsigned int emu_result;
@@ -703,164 +321,2150 @@ void execute_fib_iter(int c_size)
 
     for (int i = 0; i <= 20; i++)
     {
-        cache.size=c_size;
-        arm_state_init(&state, &cache, (unsigned int *) fib_iter_a, i, 0, 0, 0);
+        arm_state_init(state, cache, (unsigned int *) fib_iter_a, i, 0, 0, 0);
         c_result = fib_iter_c(i);
         a_result = fib_iter_a(i);
-        emu_result = armemu(&state, &cache);
+        emu_result = armemu(state, cache);
 
         printf("fib_iter_c(%d) = %d\n", i, c_result);
         printf("fib_iter_a(%d) = %d\n", i, a_result);
         printf("armemu(fib_iter_a(%d)) = %d\n\n", i, emu_result);
 
-        instruction_count_print(&state);
-        cache_output(&cache);
+        instruction_count_print(state);
+        cache_output(cache);
+    }
+    
+    armemu_destroy(machine);
+}
+
+// emulates fib(20) with func and reports instructions per second
+void execute_fib_rec_speed(int c_size, char *name, unsigned int *func)
+{
+    struct armemu_machine *machine = new_machine(c_size);
+    struct arm_state *state = &machine->state;
+    struct direct_mapped_cache *cache = &machine->cache;
+    unsigned int emu_result;
+    struct timespec start;
+    struct timespec end;
+    double seconds;
+    
+    arm_state_init(state, cache, func, 20, 0, 0, 0);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    emu_result = armemu(state, cache);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    
+    printf("armemu(%s(20)) = %d\n", name, emu_result);
+    instruction_count_print(state);
+    printf("%0.2f million instructions per second\n\n", instruction_total(state) / seconds / 1e6);
+    
+    armemu_destroy(machine);
+}
+
+void memo_compare(char *what, long long plain, long long memo)
+{
+    if (plain == memo)
+        printf("%-20s %12lld  same\n", what, plain);
+    else
+        printf("%-20s %12lld  %lld with memoization\n", what, plain, memo);
+}
+
+/* Runs func(n) with and without memoized calls and compares the result,
+   the time and every counter */
+void execute_fib_rec_memo(int c_size, char *name, unsigned int *func, int n)
+{
+    struct armemu_machine *machine[2];
+    struct arm_state *state[2];
+    struct direct_mapped_cache *cache[2];
+    struct memo_cache *memo;
+    unsigned int result[2];
+    double seconds[2];
+    struct timespec start;
+    struct timespec end;
+    int mode;
+    
+    memo = malloc(sizeof(struct memo_cache));
+    memset(memo, 0, sizeof(struct memo_cache));
+    
+    for (mode = 0; mode < 2; mode++) {
+        machine[mode] = new_machine(c_size);
+        state[mode] = &machine[mode]->state;
+        cache[mode] = &machine[mode]->cache;
+        arm_state_init(state[mode], cache[mode], func, n, 0, 0, 0);
+        if (mode == 1)
+            state[mode]->memo = memo;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        result[mode] = armemu(state[mode], cache[mode]);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        seconds[mode] = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
     }
+    
+    printf("armemu(%s(%d)) = %d, with memoized calls %d\n", name, n, result[0], result[1]);
+    printf("%0.3f ms, with memoized calls %0.3f ms, %0.0fx faster\n", seconds[0] * 1e3, seconds[1] * 1e3, seconds[0] / seconds[1]);
+    printf("calls %llu, hits %llu, recorded %llu, impure %llu\n", memo->calls, memo->hits, memo->recorded, memo->impure);
+    memo_compare("computation", state[0]->computation_count, state[1]->computation_count);
+    memo_compare("memory", state[0]->memory_count, state[1]->memory_count);
+    memo_compare("memory words", state[0]->memory_words, state[1]->memory_words);
+    memo_compare("branches taken", state[0]->branch_taken, state[1]->branch_taken);
+    memo_compare("branches not taken", state[0]->branch_not_taken, state[1]->branch_not_taken);
+    memo_compare("cache requests", cache[0]->requests, cache[1]->requests);
+    // a skipped call doesn't touch the simulated cache, so later calls can hit or miss differently
+    memo_compare("cache hits", cache[0]->cache_hit, cache[1]->cache_hit);
+    memo_compare("cache misses", cache[0]->cache_miss, cache[1]->cache_miss);
+    printf("\n");
+    
+    armemu_destroy(machine[0]);
+    armemu_destroy(machine[1]);
+    free(memo);
 }
 
 void execute_fib_rec(int c_size)
 {
-    struct arm_state state;
-    struct direct_mapped_cache cache;
+    struct armemu_machine *machine = new_machine(c_size);
+    struct arm_state *state = &machine->state;
+    struct direct_mapped_cache *cache = &machine->cache;
     unsigned int c_result;
     unsigned int a_result;
     unsigned int emu_result;
     
     for (int i = 0; i <= 20; i++)
     {
-        cache.size=c_size;
-        arm_state_init(&state, &cache, (unsigned int *) fib_rec_a, i, 0, 0, 0);
+        arm_state_init(state, cache, (unsigned int *) fib_rec_a, i, 0, 0, 0);
         c_result = fib_rec_c(i);
         a_result = fib_rec_a(i);
-        emu_result = armemu(&state, &cache);
+        emu_result = armemu(state, cache);
 
         printf("fib_rec_c(%d) = %d\n", i, c_result);
         printf("fib_rec_a(%d) = %d\n", i, a_result);
         printf("armemu(fib_rec_a(%d)) = %d\n\n", i, emu_result);
 
-        instruction_count_print(&state);
-        cache_output(&cache);
-    }    
+        instruction_count_print(state);
+        cache_output(cache);
+    }
+    
+    // compiled code is call heavy and uses push/pop, emulate fib_rec_c too
+    execute_fib_rec_speed(c_size, "fib_rec_a", (unsigned int *) fib_rec_a);
+    execute_fib_rec_speed(c_size, "fib_rec_c", (unsigned int *) fib_rec_c);
+    
+    // repeated pure calls, see memo_call
+    execute_fib_rec_memo(c_size, "fib_rec_a", (unsigned int *) fib_rec_a, 20);
+    execute_fib_rec_memo(c_size, "fib_rec_a", (unsigned int *) fib_rec_a, 25);
+    execute_fib_rec_memo(c_size, "fib_rec_c", (unsigned int *) fib_rec_c, 20);
+    
+    armemu_destroy(machine);
 }
 
 void execute_strlen(int c_size)
 {
-    struct arm_state state;
-    struct direct_mapped_cache cache;
+    struct armemu_machine *machine = new_machine(c_size);
+    struct arm_state *state = &machine->state;
+    struct direct_mapped_cache *cache = &machine->cache;
     unsigned int c_result;
     unsigned int a_result;
     unsigned int emu_result;
     char test[] = "hello";
     
-    arm_state_init(&state, &cache, (unsigned int *) strlen_a, (unsigned int)test, 0, 0, 0);
-    cache.size=c_size;
+    arm_state_init(state, cache, (unsigned int *) strlen_a, (unsigned int)test, 0, 0, 0);
     c_result = strlen_c(test);
     a_result = strlen_a(test);
-    emu_result = armemu(&state, &cache);
+    emu_result = armemu(state, cache);
     
     printf("\n-- Executing Strlen Functions --\n");
     printf("strlen_c(hello) = %d\n", c_result);
     printf("strlen_a(hello) = %d\n", a_result);
     printf("armemu(strlen_a(hello)) = %d\n", emu_result);
     
-    instruction_count_print(&state);
-    cache_output(&cache);
+    instruction_count_print(state);
+    cache_output(cache);
 
     char test2[] = "project04";
     
-    arm_state_init(&state, &cache, (unsigned int *) strlen_a, (unsigned int)test2, 0, 0, 0);
+    arm_state_init(state, cache, (unsigned int *) strlen_a, (unsigned int)test2, 0, 0, 0);
     
     c_result = strlen_c(test2);
     a_result = strlen_a(test2);
-    emu_result = armemu(&state, &cache);
+    emu_result = armemu(state, cache);
     
     printf("strlen_c(project04) = %d\n", c_result);
     printf("strlen_a(project04) = %d\n", a_result);
     printf("armemu(strlen_a(project04)) = %d\n", emu_result);
     
-    instruction_count_print(&state);
-    cache_output(&cache);
+    instruction_count_print(state);
+    cache_output(cache);
 
     char test3[] = "hi";
     
-    arm_state_init(&state, &cache, (unsigned int *) strlen_a, (unsigned int)test3, 0, 0, 0);
+    arm_state_init(state, cache, (unsigned int *) strlen_a, (unsigned int)test3, 0, 0, 0);
     
     c_result = strlen_c(test3);
     a_result = strlen_a(test3);
-    emu_result = armemu(&state, &cache);
+    emu_result = armemu(state, cache);
     
     printf("strlen_c(hi) = %d\n", c_result);
     printf("strlen_a(hi) = %d\n", a_result);
     printf("armemu(strlen_a(hi)) = %d\n", emu_result);
     
-    instruction_count_print(&state);
-    cache_output(&cache);
+    instruction_count_print(state);
+    cache_output(cache);
 
     char test4[] = "opportunity";
     
-    arm_state_init(&state, &cache, (unsigned int *) strlen_a, (unsigned int)test4, 0, 0, 0);
+    arm_state_init(state, cache, (unsigned int *) strlen_a, (unsigned int)test4, 0, 0, 0);
     
     c_result = strlen_c(test4);
     a_result = strlen_a(test4);
-    emu_result = armemu(&state, &cache);
+    emu_result = armemu(state, cache);
     
     printf("strlen_c(opportunity) = %d\n", c_result);
     printf("strlen_a(opportunity) = %d\n", a_result);
     printf("armemu(strlen_a(opportunity)) = %d\n", emu_result);
     
-    instruction_count_print(&state);
-    cache_output(&cache);
+    instruction_count_print(state);
+    cache_output(cache);
 
     char test5[] = "backpack";
     
-    arm_state_init(&state, &cache, (unsigned int *) strlen_a, (unsigned int)test5, 0, 0, 0);
+    arm_state_init(state, cache, (unsigned int *) strlen_a, (unsigned int)test5, 0, 0, 0);
     
     c_result = strlen_c(test5);
     a_result = strlen_a(test5);
-    emu_result = armemu(&state, &cache);
+    emu_result = armemu(state, cache);
     
     printf("strlen_c(backpack) = %d\n", c_result);
     printf("strlen_a(backpack) = %d\n", a_result);
     printf("armemu(strlen_a(backpack)) = %d\n", emu_result);
     
-    instruction_count_print(&state);
-    cache_output(&cache);    
+    instruction_count_print(state);
+    cache_output(cache);    
+    
+    armemu_destroy(machine);
 }
 
-int check_cache_size(int num)
+void execute_dot_product(int c_size)
 {
-    if(num > 7 && num < pow(2, 10)) {
-        if(num %4 == 0)
-            return num;
+    struct armemu_machine *machine = new_machine(c_size);
+    struct arm_state *state = &machine->state;
+    struct direct_mapped_cache *cache = &machine->cache;
+    unsigned int c_result;
+    unsigned int a_result;
+    unsigned int emu_result;
+    unsigned long long total;
+    struct timespec start;
+    struct timespec end;
+    double seconds;
+    int reps = 1000;
+    int a[1024];
+    int b[1024];
+    
+    for (int i = 0; i < 1024; i++) {
+        a[i] = i - 512;
+        b[i] = (i * 7) % 13;
     }
-    return 8;
+    
+    arm_state_init(state, cache, (unsigned int *) dot_product_a, (unsigned int) a, (unsigned int) b, 1024, 0);
+    c_result = dot_product_c(a, b, 1024);
+    a_result = dot_product_a(a, b, 1024);
+    emu_result = armemu(state, cache);
+    
+    printf("\n-- Executing Dot Product Functions (NEON) --\n");
+    printf("dot_product_c(1024) = %d\n", c_result);
+    printf("dot_product_a(1024) = %d\n", a_result);
+    printf("armemu(dot_product_a(1024)) = %d\n", emu_result);
+    
+    instruction_count_print(state);
+    cache_output(cache);
+    
+    total = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < reps; i++) {
+        arm_state_init(state, cache, (unsigned int *) dot_product_a, (unsigned int) a, (unsigned int) b, 1024, 0);
+        armemu(state, cache);
+        total += instruction_total(state);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    
+    printf("Throughput over %d runs: %0.2f million instructions per second, %0.2f million elements per second\n\n",
+           reps, total / seconds / 1e6, 1024.0 * reps / seconds / 1e6);
+    
+    armemu_destroy(machine);
 }
 
-int main(int argc, char **argv)
+/* Runs each kernel interpreted and translated by armaot, checks that the
+   results and instruction counts match and reports the speedup */
+void execute_aot(int c_size, char *path)
+{
+    struct armemu_machine *machine = new_machine(c_size);
+    struct arm_state *state = &machine->state;
+    struct direct_mapped_cache *cache = &machine->cache;
+    struct aot_code aot;
+    struct timespec start;
+    struct timespec end;
+    unsigned int emu_result;
+    unsigned int aot_result;
+    unsigned int emu_counts[5];
+    unsigned int aot_counts[5];
+    double seconds[2];
+    int reps = 1000;
+    int array[1000];
+    char str[] = "opportunity";
+    int i;
+    int k;
+    int mode;
+    
+    struct {
+        char *name;
+        unsigned int *func;
+        unsigned int args[4];
+    } checks[] = {
+        {"quadratic_a(-5, -8, -23, -1)", (unsigned int *) quadratic_a, {-5, -8, -23, -1}},
+        {"sum_array_a(0-999)", (unsigned int *) sum_array_a, {(unsigned int) array, 1000, 0, 0}},
+        {"find_max_a(0-999)", (unsigned int *) find_max_a, {(unsigned int) array, 1000, 0, 0}},
+        {"fib_iter_a(20)", (unsigned int *) fib_iter_a, {20, 0, 0, 0}},
+        {"fib_rec_a(20)", (unsigned int *) fib_rec_a, {20, 0, 0, 0}},
+        {"strlen_a(opportunity)", (unsigned int *) strlen_a, {(unsigned int) str, 0, 0, 0}},
+    };
+    
+    if (!aot_load(&aot, path)) {
+        printf("could not load %s: %s\n", path, dlerror());
+        armemu_destroy(machine);
+        return;
+    }
+    printf("-- Ahead-of-time translated code from %s, %d entry points --\n", path, aot.n);
+    
+    for (k = 0; k < sizeof(checks) / sizeof(checks[0]); k++) {
+        for (mode = 0; mode < 2; mode++) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (i = 0; i < reps; i++) {
+                // find_max_a writes to its array, start from the same values every time
+                for (int j = 0; j < 1000; j++) {
+                    array[j] = j;
+                }
+                arm_state_init(state, cache, checks[k].func, checks[k].args[0], checks[k].args[1], checks[k].args[2], checks[k].args[3]);
+                if (mode == 1)
+                    state->aot = &aot;
+                if (mode == 0)
+                    emu_result = armemu(state, cache);
+                else
+                    aot_result = armemu(state, cache);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            seconds[mode] = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+            
+            unsigned int *counts = (mode == 0) ? emu_counts : aot_counts;
+            counts[0] = state->computation_count;
+            counts[1] = state->memory_count;
+            counts[2] = state->memory_words;
+            counts[3] = state->branch_taken;
+            counts[4] = state->branch_not_taken;
+        }
+        
+        printf("\n%s\n", checks[k].name);
+        printf("armemu = %d, translated = %d: %s\n", emu_result, aot_result, emu_result == aot_result ? "match" : "MISMATCH");
+        printf("instruction counts: %s\n", memcmp(emu_counts, aot_counts, sizeof(emu_counts)) == 0 ? "match" :
+               (aot_counts[0] == 0 ? "not counted" : "MISMATCH"));
+        printf("speedup: %0.1fx (%0.3f ms interpreted, %0.3f ms translated per run)\n",
+               seconds[0] / seconds[1], seconds[0] * 1000 / reps, seconds[1] * 1000 / reps);
+    }
+    printf("\n");
+    
+    armemu_destroy(machine);
+    aot_unload(&aot);
+}
+
+/* Runs functions with and without a decode cache, which classifies each
+   region of guest code with decode_words the first time it is entered */
+void execute_decode_interpreter(int c_size)
 {
+    struct armemu_machine *machine = new_machine(c_size);
+    struct arm_state *state = &machine->state;
+    struct direct_mapped_cache *cache = &machine->cache;
+    struct decode_cache *dc;
+    struct timespec start;
+    struct timespec end;
+    unsigned int result[2];
+    unsigned int total[2];
+    double seconds[2];
+    int n = 100000;
+    int *array;
+    char *str;
+    int k;
+    int mode;
+    
+    array = malloc(n * sizeof(int));
+    str = malloc(n + 1);
+    dc = malloc(sizeof(struct decode_cache));
+    for (k = 0; k < n; k++) {
+        array[k] = (k * 37) % 1000;
+    }
+    memset(str, 'a', n);
+    str[n] = 0;
+    
+    struct {
+        char *name;
+        unsigned int *func;
+        unsigned int arg0;
+        unsigned int arg1;
+    } checks[] = {
+        {"fib_rec_a(20)", (unsigned int *) fib_rec_a, 20, 0},
+        {"sum_array_a", (unsigned int *) sum_array_a, (unsigned int) array, n},
+        {"find_max_a", (unsigned int *) find_max_a, (unsigned int) array, n},
+        {"strlen_a", (unsigned int *) strlen_a, (unsigned int) str, 0},
+    };
+    
+    printf("-- Interpreter with decoded regions --\n");
+    for (k = 0; k < sizeof(checks) / sizeof(checks[0]); k++) {
+        for (mode = 0; mode < 2; mode++) {
+            // a new cache each time, so every region is decoded on first touch
+            memset(dc, 0, sizeof(struct decode_cache));
+            arm_state_init(state, cache, checks[k].func, checks[k].arg0, checks[k].arg1, 0, 0);
+            if (mode == 1)
+                state->decode = dc;
+            
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            result[mode] = armemu(state, cache);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            seconds[mode] = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+            total[mode] = instruction_total(state);
+        }
+        printf("%-14s %s, %llu regions decoded, plain %0.3f s, cached %0.3f s, %0.2fx\n", checks[k].name,
+               result[0] == result[1] && total[0] == total[1] ? "identical" : "DIFFERENT",
+               dc->decoded, seconds[0], seconds[1], seconds[0] / seconds[1]);
+    }
+    printf("\n");
     
-    int num;
-    int size;
-    char c[] = "-c";
+    free(array);
+    free(str);
+    free(dc);
+    armemu_destroy(machine);
+}
 
-    if(argc < 2){
-        size = 8;
-    } else if (strcmp(argv[1], c)==0) {
-        num = atoi(argv[2]);
-        size = check_cache_size(num);
+/* Decodes the guest code with the scalar predicates and with the vector
+   decoder, checks that both agree on every field and block boundary, and
+   reports words decoded per second for each */
+void execute_decode(int c_size)
+{
+    struct decoded_words decoded[2];
+    struct timespec start;
+    struct timespec end;
+    double seconds[2];
+    unsigned int *words;
+    int n = 4 * 1024 * 1024;
+    int len;
+    int pos;
+    int blocks[2];
+    int mismatches = 0;
+    int reps = 16;
+    int k;
+    int r;
+    
+    unsigned int *funcs[] = {
+        (unsigned int *) quadratic_a, (unsigned int *) sum_array_a,
+        (unsigned int *) find_max_a, (unsigned int *) fib_iter_a,
+        (unsigned int *) fib_rec_a, (unsigned int *) strlen_a,
+        (unsigned int *) dot_product_a,
+    };
+    
+    // tile the guest functions, each up to and including its bx lr
+    words = malloc(n * sizeof(unsigned int));
+    len = 0;
+    while (len < n) {
+        for (k = 0; k < sizeof(funcs) / sizeof(funcs[0]) && len < n; k++) {
+            for (r = 0; len < n; r++) {
+                words[len++] = funcs[k][r];
+                if (funcs[k][r] == 0xE12FFF1E)
+                    break;
+            }
+        }
     }
+    
+    // check the two decoders chunk by chunk
+    blocks[0] = 0;
+    for (pos = 0; pos < n; pos += DECODE_MAX) {
+        len = (n - pos < DECODE_MAX) ? n - pos : DECODE_MAX;
+        blocks[0] += decode_words_scalar(&words[pos], len, &decoded[0]);
+        decode_words(&words[pos], len, &decoded[1]);
+        if (memcmp(decoded[0].kind, decoded[1].kind, len) != 0
+            || memcmp(decoded[0].rd, decoded[1].rd, len) != 0
+            || memcmp(decoded[0].rn, decoded[1].rn, len) != 0
+            || memcmp(decoded[0].rm, decoded[1].rm, len) != 0
+            || memcmp(decoded[0].end, decoded[1].end, len) != 0)
+            mismatches++;
+    }
+    
+    for (k = 0; k < 2; k++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (r = 0; r < reps; r++) {
+            blocks[k] = 0;
+            for (pos = 0; pos < n; pos += DECODE_MAX) {
+                len = (n - pos < DECODE_MAX) ? n - pos : DECODE_MAX;
+                if (k == 0)
+                    blocks[k] += decode_words_scalar(&words[pos], len, &decoded[k]);
+                else
+                    blocks[k] += decode_words(&words[pos], len, &decoded[k]);
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        seconds[k] = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    }
+    
+    printf("-- Basic block decode over %d words of guest code --\n", n);
+    printf("blocks: %d scalar, %d vector, mean length %0.1f words\n", blocks[0], blocks[1], (double) n / blocks[0]);
+    printf("scalar and vector decoders: %s (%d mismatched chunks)\n", mismatches == 0 ? "agree" : "DISAGREE", mismatches);
+    printf("scalar: %0.1f M words/s\n", (double) n * reps / seconds[0] / 1e6);
+    printf("vector: %0.1f M words/s\n", (double) n * reps / seconds[1] / 1e6);
+    printf("speedup: %0.2fx\n\n", seconds[0] / seconds[1]);
+    
+    free(words);
+    
+    execute_decode_interpreter(c_size);
+}
 
-    execute_quadratic(size);
+/* Runs fib_rec_a, sum_array_a and strlen_a in turn, first without and then
+   with live telemetry, and reports the overhead of publishing. Watch the
+   second pass with ./armmon. */
+void execute_telemetry(int c_size, int runs)
+{
+    struct armemu_machine *machine = new_machine(c_size);
+    struct arm_state *state = &machine->state;
+    struct direct_mapped_cache *cache = &machine->cache;
+    struct telemetry *telem;
+    char name[TELEM_NAME_MAX];
+    struct timespec start;
+    struct timespec end;
+    double seconds[2];
+    double elapsed;
+    unsigned long long instructions[2];
+    int n = 64 * 1024;
+    int *array;
+    char *str;
+    int round;
+    int mode;
+    int r;
+    int k;
+    
+    array = malloc(n * sizeof(int));
+    str = malloc(n + 1);
+    for (r = 0; r < n; r++) {
+        array[r] = r % 1000;
+    }
+    memset(str, 'a', n);
+    str[n] = 0;
+    
+    struct {
+        unsigned int *func;
+        unsigned int arg0;
+        unsigned int arg1;
+    } work[] = {
+        {(unsigned int *) fib_rec_a, 20, 0},
+        {(unsigned int *) sum_array_a, (unsigned int) array, n},
+        {(unsigned int *) strlen_a, (unsigned int) str, 0},
+    };
+    
+    snprintf(name, sizeof(name), TELEM_NAME_FORMAT, getpid());
+    telem = telemetry_create(name);
+    if (telem == NULL) {
+        printf("could not create /dev/shm%s: %s\n", name, strerror(errno));
+        armemu_destroy(machine);
+        return;
+    }
+    printf("-- Live telemetry, %d runs of each kernel, watch with ./armmon -p %d --\n", runs, getpid());
+    fflush(stdout);
+    
+    // alternate the two passes and keep the fastest of each, so a noisy
+    // machine or a monitor sharing the core doesn't count as overhead
+    seconds[0] = seconds[1] = 1e9;
+    for (round = 0; round < 6; round++) {
+        mode = round % 2;
+        instructions[mode] = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (r = 0; r < runs; r++) {
+            for (k = 0; k < sizeof(work) / sizeof(work[0]); k++) {
+                arm_state_init(state, cache, work[k].func, work[k].arg0, work[k].arg1, 0, 0);
+                if (mode == 1)
+                    state->telem = telem;
+                armemu(state, cache);
+                instructions[mode] += instruction_total(state);
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        if (elapsed < seconds[mode])
+            seconds[mode] = elapsed;
+    }
     
-    execute_sum_array(size);
+    printf("without telemetry: %0.3f s, %0.1f MIPS\n", seconds[0], instructions[0] / seconds[0] / 1e6);
+    printf("with telemetry:    %0.3f s, %0.1f MIPS\n", seconds[1], instructions[1] / seconds[1] / 1e6);
+    printf("end to end overhead: %0.2f%%\n", (seconds[1] / seconds[0] - 1) * 100);
+    
+    // the end to end figure is within noise, so time the publish itself
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < 1000000; r++) {
+        telemetry_publish(telem, state, cache);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / 1000000;
+    printf("one publish: %0.1f ns every %d instructions, %0.4f%% of run time\n\n", elapsed, TELEM_INTERVAL,
+           100 * elapsed / (elapsed + TELEM_INTERVAL * 1e9 * seconds[0] / instructions[0]));
+    
+    telemetry_destroy(telem, name);
+    free(array);
+    free(str);
+    
+    armemu_destroy(machine);
+}
 
-    execute_find_max(size);
+// resident set size of this process in bytes
+long resident_bytes(void)
+{
+    long pages = 0;
+    long resident = 0;
+    FILE *f;
+    
+    f = fopen("/proc/self/statm", "r");
+    if (f == NULL)
+        return 0;
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(f);
+    return resident * sysconf(_SC_PAGESIZE);
+}
 
-    execute_fib_iter(size);
+/* Creates n machines in one arena and runs fib_rec_a(10) on each, then
+   does the same with a guard page under every stack, reporting creation
+   cost and memory per machine */
+void execute_instances(int c_size, int n)
+{
+    struct armemu_config config;
+    struct armemu_arena *arena;
+    struct armemu_machine **machines;
+    struct armemu_stats stats;
+    struct timespec start;
+    struct timespec end;
+    double seconds;
+    long before;
+    long after;
+    int created;
+    int wrong;
+    int guard;
+    int i;
+    FILE *f;
+    long max_map_count = 0;
+    
+    machines = malloc(n * sizeof(struct armemu_machine *));
+    armemu_config_default(&config);
+    config.cache_size = c_size;
+    
+    f = fopen("/proc/sys/vm/max_map_count", "r");
+    if (f != NULL) {
+        if (fscanf(f, "%ld", &max_map_count) != 1)
+            max_map_count = 0;
+        fclose(f);
+    }
     
-    execute_fib_rec(size);
+    printf("-- %d machines, %d byte stacks, %d cache slots --\n", n, config.stack_size, config.cache_size);
+    
+    for (guard = 0; guard < 2; guard++) {
+        config.guard_page = guard;
+        // guard pages need normal pages, and a mapping of their own is as cheap as an arena
+        arena = NULL;
+        if (!guard) {
+            arena = armemu_arena_create((size_t) n * (config.stack_size + sizeof(struct armemu_machine) + 64 + c_size * (sizeof(struct cache_slot) + sizeof(int))), true);
+            if (arena == NULL) {
+                perror("armemu_arena_create");
+                return;
+            }
+        }
+        
+        before = resident_bytes();
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (created = 0; created < n; created++) {
+            machines[created] = armemu_create(arena, &config);
+            if (machines[created] == NULL)
+                break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        
+        wrong = 0;
+        for (i = 0; i < created; i++) {
+            armemu_run(machines[i], (unsigned int *) fib_rec_a, 10, 0, 0, 0);
+            armemu_query(machines[i], &stats);
+            if (stats.result != 55 || stats.fault != FAULT_NONE)
+                wrong++;
+        }
+        after = resident_bytes();
+        
+        if (guard) {
+            printf("\nwith guard pages, own mapping each (vm.max_map_count = %ld)\n", max_map_count);
+        } else {
+            printf("\narena on %s pages\n", armemu_arena_huge(arena) ? "huge" : "normal");
+        }
+        if (created < n)
+            printf("created %d before armemu_create failed: %s\n", created, strerror(errno));
+        printf("create: %0.0f ns per machine\n", seconds * 1e9 / created);
+        printf("memory: %zu bytes reserved, %ld bytes resident per machine after one run\n",
+               machines[0] == NULL ? 0 : machines[0]->block_size, (after - before) / (created > 0 ? created : 1));
+        printf("fib_rec_a(10) on every machine: %s\n", wrong == 0 ? "correct" : "WRONG");
+        
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < created; i++) {
+            armemu_destroy(machines[i]);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        printf("destroy: %0.0f ns per machine\n", seconds * 1e9 / (created > 0 ? created : 1));
+        if (arena != NULL)
+            armemu_arena_destroy(arena);
+    }
+    printf("\n");
+    free(machines);
+}
+
+/* Runs fib_rec_a on n contexts, first one after another to completion and
+   then under the scheduler with a range of time slices, checking every
+   result and reporting throughput, the cost of a switch and how long
+   contexts wait for a worker */
+void execute_sched(int c_size, int n)
+{
+    struct armemu_config config;
+    struct armemu_arena *arena;
+    struct armemu_machine **machines;
+    struct armemu_task *tasks;
+    struct armemu_sched *sched;
+    struct armemu_sched_stats stats;
+    struct timespec start;
+    struct timespec end;
+    unsigned int slices[] = {1000, 10000, 100000};
+    unsigned long long instructions;
+    unsigned long long wait_ns[ARMEMU_PRIORITIES];
+    unsigned long long dispatches[ARMEMU_PRIORITIES];
+    unsigned long long max_wait_ns;
+    unsigned int *expected;
+    double sequential;
+    double seconds;
+    int nworkers;
+    int wrong;
+    int i;
+    int k;
+    int p;
+    
+    nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nworkers < 1)
+        nworkers = 1;
+    
+    armemu_config_default(&config);
+    config.cache_size = c_size;
+    arena = armemu_arena_create((size_t) n * (config.stack_size + sizeof(struct armemu_machine) + 64 + c_size * (sizeof(struct cache_slot) + sizeof(int))), true);
+    machines = malloc(n * sizeof(struct armemu_machine *));
+    tasks = malloc(n * sizeof(struct armemu_task));
+    expected = malloc(n * sizeof(unsigned int));
+    if (arena == NULL || machines == NULL || tasks == NULL || expected == NULL) {
+        perror("execute_sched");
+        exit(1);
+    }
+    for (i = 0; i < n; i++) {
+        machines[i] = armemu_create(arena, &config);
+        if (machines[i] == NULL) {
+            perror("armemu_create");
+            exit(1);
+        }
+        expected[i] = fib_rec_c(10 + i % 8);
+    }
+    
+    printf("-- %d contexts running fib_rec_a(10-17) on %d workers --\n", n, nworkers);
+    
+    // every context run to completion in turn, no switches, after a pass
+    // that warms the caches
+    for (i = 0; i < n; i++) {
+        armemu_run(machines[i], (unsigned int *) fib_rec_a, 10 + i % 8, 0, 0, 0);
+    }
+    instructions = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < n; i++) {
+        armemu_run(machines[i], (unsigned int *) fib_rec_a, 10 + i % 8, 0, 0, 0);
+        instructions += instruction_total(&machines[i]->state);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    sequential = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("\none after another: %0.3f s, %0.1f MIPS\n", sequential, instructions / sequential / 1e6);
+    
+    for (k = 0; k < sizeof(slices) / sizeof(slices[0]); k++) {
+        sched = armemu_sched_create(nworkers, slices[k]);
+        for (i = 0; i < n; i++) {
+            armemu_start(machines[i], (unsigned int *) fib_rec_a, 10 + i % 8, 0, 0, 0);
+            tasks[i].machine = machines[i];
+            tasks[i].priority = i % ARMEMU_PRIORITIES;
+            armemu_sched_submit(sched, &tasks[i]);
+        }
+        
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (!armemu_sched_start(sched))
+            printf("only some worker threads started\n");
+        armemu_sched_wait(sched);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        armemu_sched_stats(sched, &stats);
+        
+        wrong = 0;
+        max_wait_ns = 0;
+        memset(wait_ns, 0, sizeof(wait_ns));
+        memset(dispatches, 0, sizeof(dispatches));
+        for (i = 0; i < n; i++) {
+            if (!tasks[i].done || machines[i]->state.fault != FAULT_NONE || machines[i]->state.regs[0] != expected[i])
+                wrong++;
+            wait_ns[tasks[i].priority] += tasks[i].wait_ns;
+            dispatches[tasks[i].priority] += tasks[i].slices;
+            if (tasks[i].max_wait_ns > max_wait_ns)
+                max_wait_ns = tasks[i].max_wait_ns;
+        }
+        
+        printf("\nslice %d instructions: %0.3f s, %0.1f MIPS, results %s\n", slices[k], seconds,
+               stats.instructions / seconds / 1e6, wrong == 0 ? "correct" : "WRONG");
+        printf("switches: %llu (%0.0f per second), steals: %llu\n", stats.dispatches, stats.dispatches / seconds, stats.steals);
+        // worker time outside armemu() is queueing, stealing and idling
+        printf("cost per switch: %0.0f ns, %0.1f%% of worker time\n", (seconds * nworkers * 1e9 - stats.run_ns) / stats.dispatches,
+               100 - 100.0 * stats.run_ns / (seconds * nworkers * 1e9));
+        printf("wait for a worker: max %0.1f ms, mean by priority", max_wait_ns / 1e6);
+        for (p = 0; p < ARMEMU_PRIORITIES; p++) {
+            printf(" %0.2f", dispatches[p] == 0 ? 0 : wait_ns[p] / 1e6 / dispatches[p]);
+        }
+        printf(" ms\n");
+        
+        armemu_sched_destroy(sched);
+    }
+    printf("\n");
+    
+    armemu_arena_destroy(arena);
+    free(machines);
+    free(tasks);
+    free(expected);
+}
+
+/* Runs the loop kernels over millions of elements interpreted and with hot
+   loop traces, and checks that every counter comes out the same */
+void execute_loops(int c_size)
+{
+    struct armemu_machine *machine[2];
+    struct arm_state *state[2];
+    struct direct_mapped_cache *cache[2];
+    struct loop_cache *loops;
+    struct timespec start;
+    struct timespec end;
+    unsigned int result[2];
+    double seconds[2];
+    int n = 4 * 1024 * 1024;
+    int *array;
+    char *str;
+    bool same;
+    int k;
+    int mode;
+    
+    array = malloc(n * sizeof(int));
+    str = malloc(n + 1);
+    loops = malloc(sizeof(struct loop_cache));
+    memset(str, 'a', n);
+    str[n] = 0;
+    for (mode = 0; mode < 2; mode++) {
+        machine[mode] = new_machine(c_size);
+        state[mode] = &machine[mode]->state;
+        cache[mode] = &machine[mode]->cache;
+    }
+    
+    struct {
+        char *name;
+        unsigned int *func;
+        unsigned int arg0;
+        unsigned int arg1;
+    } checks[] = {
+        {"sum_array_a", (unsigned int *) sum_array_a, (unsigned int) array, n},
+        {"find_max_a", (unsigned int *) find_max_a, (unsigned int) array, n},
+        {"strlen_a", (unsigned int *) strlen_a, (unsigned int) str, 0},
+    };
+    
+    printf("-- Hot loop traces over %d elements --\n", n);
+    
+    for (k = 0; k < sizeof(checks) / sizeof(checks[0]); k++) {
+        for (mode = 0; mode < 2; mode++) {
+            for (int i = 0; i < n; i++) {
+                array[i] = (i * 37) % 1000;
+            }
+            memset(loops, 0, sizeof(struct loop_cache));
+            
+            arm_state_init(state[mode], cache[mode], checks[k].func, checks[k].arg0, checks[k].arg1, 0, 0);
+            if (mode == 1)
+                state[mode]->loops = loops;
+            
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            result[mode] = armemu(state[mode], cache[mode]);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            seconds[mode] = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        }
+        
+        same = result[0] == result[1]
+            && state[0]->computation_count == state[1]->computation_count
+            && state[0]->memory_count == state[1]->memory_count
+            && state[0]->memory_words == state[1]->memory_words
+            && state[0]->branch_taken == state[1]->branch_taken
+            && state[0]->branch_not_taken == state[1]->branch_not_taken
+            && cache[0]->requests == cache[1]->requests
+            && cache[0]->cache_hit == cache[1]->cache_hit
+            && cache[0]->cache_miss == cache[1]->cache_miss;
+        
+        printf("\n%s = %d, with traces = %d\n", checks[k].name, result[0], result[1]);
+        printf("counters and cache statistics: %s\n", same ? "identical" : "DIFFERENT");
+        instruction_count_print(state[1]);
+        cache_output(cache[1]);
+        printf("%0.3f s interpreted, %0.3f s with traces, %0.1fx speedup\n", seconds[0], seconds[1], seconds[0] / seconds[1]);
+    }
+    printf("\n");
+    
+    free(array);
+    free(str);
+    free(loops);
+    
+    armemu_destroy(machine[0]);
+    armemu_destroy(machine[1]);
+}
+
+/* Coverage-guided fuzzing of the assembly functions against their C versions */
+
+#define FUZZ_BUF_SIZE 256
+#define FUZZ_CORPUS_MAX 256
+#define FUZZ_MAX_WORKERS 64
+#define FUZZ_BUDGET (1 << 20)
+#define FUZZ_REPORTS 2
+
+#define FUZZ_ARGS 0         // four integer arguments
+#define FUZZ_INT_ARRAY 1    // r0 = int array in the buffer, r1 = number of elements
+#define FUZZ_STRING 2       // r0 = NUL terminated string in the buffer
+#define FUZZ_INT 3          // r0 = integer in [0, max_arg]
+#define FUZZ_INT_ARRAY_PAIR 4   // r0, r1 = halves of the buffer, r2 = elements in each
+
+struct fuzz_input {
+    unsigned int args[4];
+    int len;                // bytes of buf in use
+    unsigned char buf[FUZZ_BUF_SIZE];
+};
+
+struct fuzz_target {
+    char *name;
+    unsigned int *func;
+    int (*native)(struct fuzz_input *in);
+    int kind;
+    unsigned int max_arg;
+};
+
+struct fuzz_stats {
+    unsigned long long execs;
+    unsigned long long crashes;
+    unsigned long long hangs;
+    unsigned long long mismatches;
+    unsigned int corpus;
+    unsigned int edges;
+    double seconds;
+};
+
+struct fuzz_worker {
+    int id;
+    struct armemu_machine *machine;
+    struct arm_state *state;
+    struct direct_mapped_cache *cache;
+    struct fuzz_target *target;
+    struct fuzz_stats *stats;
+    unsigned int rng;
+    int reported;
+    unsigned char guest_buf[FUZZ_BUF_SIZE];
+    unsigned char cov_map[COV_MAP_SIZE];
+    unsigned short cov_dirty[COV_MAP_SIZE];
+    unsigned char virgin[COV_MAP_SIZE];
+    struct fuzz_input corpus[FUZZ_CORPUS_MAX];
+    int ncorpus;
+};
+
+int fuzz_quadratic_c(struct fuzz_input *in)
+{
+    return quadratic_c(in->args[0], in->args[1], in->args[2], in->args[3]);
+}
+
+int fuzz_sum_array_c(struct fuzz_input *in)
+{
+    return sum_array_c((int *) in->buf, in->len / 4);
+}
+
+int fuzz_find_max_c(struct fuzz_input *in)
+{
+    return find_max_c((int *) in->buf, in->len / 4);
+}
+
+int fuzz_fib_iter_c(struct fuzz_input *in)
+{
+    return fib_iter_c(in->args[0]);
+}
+
+int fuzz_fib_rec_c(struct fuzz_input *in)
+{
+    return fib_rec_c(in->args[0]);
+}
+
+int fuzz_strlen_c(struct fuzz_input *in)
+{
+    return strlen_c((char *) in->buf);
+}
+
+struct fuzz_target fuzz_targets[] = {
+    {"quadratic", (unsigned int *) quadratic_a, fuzz_quadratic_c, FUZZ_ARGS, 0},
+    {"sum_array", (unsigned int *) sum_array_a, fuzz_sum_array_c, FUZZ_INT_ARRAY, 0},
+    {"find_max", (unsigned int *) find_max_a, fuzz_find_max_c, FUZZ_INT_ARRAY, 0},
+    {"fib_iter", (unsigned int *) fib_iter_a, fuzz_fib_iter_c, FUZZ_INT, 46},
+    {"fib_rec", (unsigned int *) fib_rec_a, fuzz_fib_rec_c, FUZZ_INT, 16},
+    {"strlen", (unsigned int *) strlen_a, fuzz_strlen_c, FUZZ_STRING, 0},
+};
+
+#define FUZZ_NTARGETS (sizeof(fuzz_targets) / sizeof(fuzz_targets[0]))
+
+unsigned int fuzz_interesting[] = {0, 1, 2, 16, 255, 256, 0x7FFFFFFF, 0x80000000, 0xFFFFFFFF};
+
+#define FUZZ_NINTERESTING (sizeof(fuzz_interesting) / sizeof(fuzz_interesting[0]))
+
+unsigned int xorshift32(unsigned int *rng)
+{
+    *rng ^= *rng << 13;
+    *rng ^= *rng >> 17;
+    *rng ^= *rng << 5;
+    return *rng;
+}
+
+unsigned int fuzz_rand(struct fuzz_worker *w)
+{
+    return xorshift32(&w->rng);
+}
+
+// AFL hit count buckets
+unsigned char fuzz_bucket(unsigned char count)
+{
+    if (count <= 3)
+        return count == 3 ? 4 : count;
+    if (count <= 7)
+        return 8;
+    if (count <= 15)
+        return 16;
+    if (count <= 31)
+        return 32;
+    if (count <= 127)
+        return 64;
+    return 128;
+}
+
+// makes an input well formed for the target's argument kind
+void fuzz_normalize(struct fuzz_target *t, struct fuzz_input *in)
+{
+    switch (t->kind)
+    {
+        case FUZZ_INT_ARRAY:
+            in->len = in->len & ~3;
+            break;
+        case FUZZ_STRING:
+            if (in->len == 0)
+                in->len = 1;
+            in->buf[in->len - 1] = 0;
+            break;
+        case FUZZ_INT:
+            in->args[0] = in->args[0] % (t->max_arg + 1);
+            break;
+    }
+}
+
+void fuzz_mutate(struct fuzz_worker *w, struct fuzz_input *in)
+{
+    int i;
+    int n;
+    int pos;
+    int newlen;
+    struct fuzz_input *other;
+    
+    n = 1 + fuzz_rand(w) % 4;
+    for (i = 0; i < n; i++) {
+        switch (fuzz_rand(w) % 7)
+        {
+            case 0: //flip a bit of an argument
+                in->args[fuzz_rand(w) % 4] ^= 1 << (fuzz_rand(w) % 32);
+                break;
+            case 1: //interesting argument
+                in->args[fuzz_rand(w) % 4] = fuzz_interesting[fuzz_rand(w) % FUZZ_NINTERESTING];
+                break;
+            case 2: //small delta on an argument
+                in->args[fuzz_rand(w) % 4] += (fuzz_rand(w) % 33) - 16;
+                break;
+            case 3: //flip a bit of the buffer
+                if (in->len > 0)
+                    in->buf[fuzz_rand(w) % in->len] ^= 1 << (fuzz_rand(w) % 8);
+                break;
+            case 4: //interesting word in the buffer
+                if (in->len >= 4) {
+                    pos = (fuzz_rand(w) % (in->len / 4)) * 4;
+                    *((unsigned int *) &in->buf[pos]) = fuzz_interesting[fuzz_rand(w) % FUZZ_NINTERESTING];
+                }
+                break;
+            case 5: //resize the buffer, new bytes are random
+                newlen = fuzz_rand(w) % (FUZZ_BUF_SIZE + 1);
+                for (pos = in->len; pos < newlen; pos++) {
+                    in->buf[pos] = fuzz_rand(w);
+                }
+                in->len = newlen;
+                break;
+            case 6: //splice the tail of another corpus entry
+                other = &w->corpus[fuzz_rand(w) % w->ncorpus];
+                if (other->len > 0) {
+                    pos = fuzz_rand(w) % (other->len + 1);
+                    memcpy(&in->buf[pos], &other->buf[pos], other->len - pos);
+                    in->len = other->len;
+                }
+                break;
+        }
+    }
+    fuzz_normalize(w->target, in);
+}
+
+void fuzz_report(struct fuzz_worker *w, char *what, struct fuzz_input *in, unsigned int emu_result, unsigned int c_result)
+{
+    if (w->reported >= FUZZ_REPORTS)
+        return;
+    w->reported++;
+    
+    printf("[worker %d] %s %s: r0-r3 = %d %d %d %d, buffer %d bytes, armemu = %d, c = %d\n",
+           w->id, w->target->name, what, in->args[0], in->args[1], in->args[2], in->args[3],
+           in->len, emu_result, c_result);
+}
+
+// runs one input, returns true if it reached new coverage
+bool fuzz_run(struct fuzz_worker *w, struct fuzz_input *in)
+{
+    struct fuzz_target *t = w->target;
+    struct arm_state *state = w->state;
+    unsigned int args[4];
+    unsigned int emu_result;
+    unsigned int c_result;
+    unsigned int idx;
+    unsigned char bucket;
+    bool new_bits = false;
+    int i;
+    
+    memcpy(args, in->args, sizeof(args));
+    state->mem_lo = 0;
+    state->mem_hi = 0;
+    if (t->kind == FUZZ_INT_ARRAY || t->kind == FUZZ_STRING) {
+        // the guest gets a private copy, find_max_a writes to its array
+        memcpy(w->guest_buf, in->buf, in->len);
+        args[0] = (unsigned int) w->guest_buf;
+        state->mem_lo = args[0];
+        state->mem_hi = args[0] + in->len;
+        if (t->kind == FUZZ_INT_ARRAY)
+            args[1] = in->len / 4;
+    }
+    
+    arm_state_reset(state, w->cache, t->func, args[0], args[1], args[2], args[3]);
+    emu_result = armemu(state, w->cache);
+    w->stats->execs++;
+    
+    if (state->fault == FAULT_HANG) {
+        w->stats->hangs++;
+        fuzz_report(w, "hang", in, emu_result, 0);
+    } else if (state->fault != FAULT_NONE) {
+        w->stats->crashes++;
+        fuzz_report(w, "crash", in, emu_result, 0);
+    } else {
+        c_result = t->native(in);
+        if (emu_result != c_result) {
+            w->stats->mismatches++;
+            fuzz_report(w, "mismatch", in, emu_result, c_result);
+        }
+    }
+    
+    for (i = 0; i < state->cov_ndirty; i++) {
+        idx = state->cov_dirty[i];
+        bucket = fuzz_bucket(state->cov_map[idx]);
+        if (bucket & ~w->virgin[idx]) {
+            if (w->virgin[idx] == 0)
+                w->stats->edges++;
+            w->virgin[idx] |= bucket;
+            new_bits = true;
+        }
+    }
+    return new_bits;
+}
+
+void fuzz_target_run(struct fuzz_worker *w, struct fuzz_target *t, unsigned long long iterations)
+{
+    struct fuzz_input in;
+    unsigned int code_lo;
+    unsigned int code_hi;
+    struct timespec start;
+    struct timespec end;
+    unsigned long long i;
+    int k;
+    
+    // instructions can be fetched from anywhere in the emulated functions' text
+    code_lo = (unsigned int) fuzz_targets[0].func;
+    code_hi = code_lo;
+    for (k = 0; k < FUZZ_NTARGETS; k++) {
+        if ((unsigned int) fuzz_targets[k].func < code_lo)
+            code_lo = (unsigned int) fuzz_targets[k].func;
+        if ((unsigned int) fuzz_targets[k].func > code_hi)
+            code_hi = (unsigned int) fuzz_targets[k].func;
+    }
+    
+    w->target = t;
+    w->reported = 0;
+    w->ncorpus = 0;
+    memset(w->virgin, 0, sizeof(w->virgin));
+    memset(w->cov_map, 0, sizeof(w->cov_map));
+    
+    arm_state_init(w->state, w->cache, t->func, 0, 0, 0, 0);
+    w->state->budget = FUZZ_BUDGET;
+    w->state->check_mem = true;
+    w->state->code_lo = code_lo;
+    w->state->code_hi = code_hi + 1024;
+    w->state->cov_map = w->cov_map;
+    w->state->cov_dirty = w->cov_dirty;
+    
+    // seed input
+    memset(&in, 0, sizeof(in));
+    if (t->kind == FUZZ_INT_ARRAY) {
+        in.len = 16;
+        for (k = 0; k < 4; k++) {
+            ((int *) in.buf)[k] = k + 1;
+        }
+    } else if (t->kind == FUZZ_STRING) {
+        strcpy((char *) in.buf, "hello");
+        in.len = 6;
+    } else {
+        in.args[0] = 1;
+        in.args[1] = 2;
+        in.args[2] = 3;
+        in.args[3] = 4;
+    }
+    fuzz_normalize(t, &in);
+    fuzz_run(w, &in);
+    w->corpus[w->ncorpus++] = in;
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < iterations; i++) {
+        in = w->corpus[fuzz_rand(w) % w->ncorpus];
+        fuzz_mutate(w, &in);
+        if (fuzz_run(w, &in) && w->ncorpus < FUZZ_CORPUS_MAX)
+            w->corpus[w->ncorpus++] = in;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    
+    w->stats->corpus = w->ncorpus;
+    w->stats->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/* Fuzz every target with one forked worker per core; stats come back
+   through a shared mapping */
+void execute_fuzz(int c_size, unsigned long long iterations)
+{
+    struct fuzz_stats *stats;
+    struct fuzz_stats total;
+    struct fuzz_worker *w;
+    double rate;
+    int nworkers;
+    int i;
+    int k;
+    
+    nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nworkers < 1)
+        nworkers = 1;
+    if (nworkers > FUZZ_MAX_WORKERS)
+        nworkers = FUZZ_MAX_WORKERS;
+    
+    stats = mmap(NULL, sizeof(struct fuzz_stats) * nworkers * FUZZ_NTARGETS, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (stats == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    memset(stats, 0, sizeof(struct fuzz_stats) * nworkers * FUZZ_NTARGETS);
+    
+    printf("-- Fuzzing with %d workers, %llu executions per target per worker --\n", nworkers, iterations);
+    fflush(stdout);
+    
+    for (i = 0; i < nworkers; i++) {
+        if (fork() == 0) {
+            w = malloc(sizeof(struct fuzz_worker));
+            w->id = i;
+            w->machine = new_machine(c_size);
+            w->state = &w->machine->state;
+            w->cache = &w->machine->cache;
+            w->rng = 0x9E3779B9 * (i + 1) ^ (unsigned int) time(NULL);
+            if (w->rng == 0)
+                w->rng = 1;
+            for (k = 0; k < FUZZ_NTARGETS; k++) {
+                w->stats = &stats[i * FUZZ_NTARGETS + k];
+                fuzz_target_run(w, &fuzz_targets[k], iterations);
+                fflush(stdout);
+            }
+            exit(0);
+        }
+    }
+    for (i = 0; i < nworkers; i++) {
+        wait(NULL);
+    }
+    
+    for (k = 0; k < FUZZ_NTARGETS; k++) {
+        memset(&total, 0, sizeof(total));
+        rate = 0;
+        for (i = 0; i < nworkers; i++) {
+            struct fuzz_stats *s = &stats[i * FUZZ_NTARGETS + k];
+            total.execs += s->execs;
+            total.crashes += s->crashes;
+            total.hangs += s->hangs;
+            total.mismatches += s->mismatches;
+            if (s->edges > total.edges)
+                total.edges = s->edges;
+            if (s->corpus > total.corpus)
+                total.corpus = s->corpus;
+            if (s->seconds > 0)
+                rate += s->execs / s->seconds;
+        }
+        printf("\n%s\n", fuzz_targets[k].name);
+        printf("Executions: %llu (%0.0f per second)\n", total.execs, rate);
+        printf("Edges: %d\n", total.edges);
+        printf("Corpus: %d\n", total.corpus);
+        printf("Crashes: %llu\n", total.crashes);
+        printf("Hangs: %llu\n", total.hangs);
+        printf("Mismatches: %llu\n", total.mismatches);
+    }
+    
+    munmap(stats, sizeof(struct fuzz_stats) * nworkers * FUZZ_NTARGETS);
+}
+
+/* Differential co-simulation: millions of generated inputs per function,
+   each run in the emulator, natively and through the C version. The
+   native assembly is called through the same function pointer with the
+   same r0-r3 the emulator gets, so return values and the buffer the
+   function was given must match exactly. */
+
+#define DIFF_BATCH 64
+#define DIFF_MIN_TRIES 4096
+
+#define DIFF_OK 0
+#define DIFF_FAULT 1        // the emulator faulted or hung
+#define DIFF_RESULT 2       // emulator and native return different values
+#define DIFF_MEMORY 3       // emulator and native leave the buffer different
+#define DIFF_REFERENCE 4    // native and C return different values
+#define DIFF_CRASH 5        // the native code died of a signal
+#define DIFF_CLASSES 6
+
+char *diff_names[] = {"ok", "fault", "result mismatch", "memory mismatch", "reference mismatch", "native crash"};
+
+typedef int (*diff_native_func)(unsigned int a0, unsigned int a1, unsigned int a2, unsigned int a3);
+
+/* Inputs a target's native code accepts; outside these the assembly runs
+   off its buffer or loops for a long time */
+struct diff_target {
+    char *name;
+    unsigned int *func;
+    int (*reference)(struct fuzz_input *in);
+    int kind;
+    unsigned int max_arg;
+    int min_len;            // smallest buffer in bytes
+    int len_multiple;       // buffer length must be a multiple of this
+};
+
+struct diff_stats {
+    unsigned long long checks;
+    unsigned long long failures[DIFF_CLASSES];
+    double seconds;
+};
+
+// one input and what each implementation did with it
+struct diff_slot {
+    struct fuzz_input in;
+    unsigned int emu_result;
+    int fault;
+    unsigned int native_result;
+    int signal;                 // what the native code died of, or 0
+    unsigned int c_result;
+    unsigned char emu_buf[FUZZ_BUF_SIZE];
+    unsigned char native_buf[FUZZ_BUF_SIZE];
+};
+
+struct diff_worker {
+    int id;
+    struct armemu_machine *machine;
+    struct diff_target *target;
+    struct diff_stats *stats;
+    unsigned int rng;
+    int reported;
+    struct diff_slot batch[DIFF_BATCH];
+    struct diff_slot candidate;
+};
+
+int fuzz_dot_product_c(struct fuzz_input *in)
+{
+    int n = in->len / 8;
+    
+    return dot_product_c((int *) in->buf, (int *) (in->buf + n * 4), n);
+}
+
+struct diff_target diff_targets[] = {
+    {"quadratic", (unsigned int *) quadratic_a, fuzz_quadratic_c, FUZZ_ARGS, 0, 0, 1},
+    {"sum_array", (unsigned int *) sum_array_a, fuzz_sum_array_c, FUZZ_INT_ARRAY, 0, 0, 4},
+    {"find_max", (unsigned int *) find_max_a, fuzz_find_max_c, FUZZ_INT_ARRAY, 0, 4, 4},
+    {"fib_iter", (unsigned int *) fib_iter_a, fuzz_fib_iter_c, FUZZ_INT, 46, 0, 1},
+    {"fib_rec", (unsigned int *) fib_rec_a, fuzz_fib_rec_c, FUZZ_INT, 16, 0, 1},
+    {"strlen", (unsigned int *) strlen_a, fuzz_strlen_c, FUZZ_STRING, 0, 1, 1},
+    {"dot_product", (unsigned int *) dot_product_a, fuzz_dot_product_c, FUZZ_INT_ARRAY_PAIR, 0, 0, 32},
+};
+
+#define DIFF_NTARGETS (sizeof(diff_targets) / sizeof(diff_targets[0]))
+
+// an argument or array element, mostly edge cases and small numbers
+unsigned int diff_value(struct diff_worker *w)
+{
+    switch (xorshift32(&w->rng) % 4)
+    {
+        case 0:
+            return fuzz_interesting[xorshift32(&w->rng) % FUZZ_NINTERESTING];
+        case 1:
+            return (xorshift32(&w->rng) % 33) - 16;
+        default:
+            return xorshift32(&w->rng);
+    }
+}
+
+// makes an input one the target accepts, zeroing what it doesn't use
+void diff_normalize(struct diff_target *t, struct fuzz_input *in)
+{
+    if (t->kind == FUZZ_ARGS || t->kind == FUZZ_INT)
+        in->len = 0;
+    in->len -= in->len % t->len_multiple;
+    if (in->len < t->min_len) {
+        memset(&in->buf[in->len], 1, t->min_len - in->len);
+        in->len = t->min_len;
+    }
+    if (t->kind == FUZZ_STRING)
+        in->buf[in->len - 1] = 0;
+    
+    if (t->kind == FUZZ_ARGS)
+        return;
+    if (t->kind == FUZZ_INT)
+        in->args[0] = in->args[0] % (t->max_arg + 1);
+    else
+        in->args[0] = 0;
+    in->args[1] = 0;
+    in->args[2] = 0;
+    in->args[3] = 0;
+}
+
+void diff_generate(struct diff_worker *w, struct fuzz_input *in)
+{
+    int i;
+    
+    for (i = 0; i < 4; i++) {
+        in->args[i] = diff_value(w);
+    }
+    in->len = xorshift32(&w->rng) % (FUZZ_BUF_SIZE + 1);
+    if (w->target->kind == FUZZ_STRING) {
+        for (i = 0; i < in->len; i++) {
+            in->buf[i] = 1 + xorshift32(&w->rng) % 255;
+        }
+    } else {
+        for (i = 0; i + 4 <= in->len; i += 4) {
+            *((unsigned int *) &in->buf[i]) = diff_value(w);
+        }
+    }
+    diff_normalize(w->target, in);
+}
+
+// r0-r3 for an input whose buffer has been copied to buf
+void diff_args(struct diff_target *t, struct fuzz_input *in, unsigned char *buf, unsigned int *args)
+{
+    memcpy(args, in->args, sizeof(in->args));
+    switch (t->kind)
+    {
+        case FUZZ_INT_ARRAY:
+            args[0] = (unsigned int) buf;
+            args[1] = in->len / 4;
+            break;
+        case FUZZ_STRING:
+            args[0] = (unsigned int) buf;
+            break;
+        case FUZZ_INT_ARRAY_PAIR:
+            args[0] = (unsigned int) buf;
+            args[1] = (unsigned int) (buf + in->len / 2);
+            args[2] = in->len / 8;
+            break;
+    }
+}
+
+void diff_emulate(struct diff_worker *w, struct diff_slot *s)
+{
+    struct arm_state *state = &w->machine->state;
+    struct direct_mapped_cache *cache = &w->machine->cache;
+    unsigned int args[4];
+    
+    memcpy(s->emu_buf, s->in.buf, s->in.len);
+    diff_args(w->target, &s->in, s->emu_buf, args);
+    state->mem_lo = (unsigned int) s->emu_buf;
+    state->mem_hi = (unsigned int) s->emu_buf + s->in.len;
+    arm_state_reset(state, cache, w->target->func, args[0], args[1], args[2], args[3]);
+    s->emu_result = armemu(state, cache);
+    s->fault = state->fault;
+}
+
+/* Where a crash in the native code returns to. The handler runs on its
+   own stack, since the native code may have left sp anywhere. */
+sigjmp_buf diff_crash_jump;
+
+void diff_crash_handler(int sig)
+{
+    siglongjmp(diff_crash_jump, sig);
+}
+
+void diff_catch_crashes(void)
+{
+    struct sigaction action;
+    stack_t stack;
+    
+    stack.ss_sp = malloc(SIGSTKSZ);
+    stack.ss_size = SIGSTKSZ;
+    stack.ss_flags = 0;
+    if (stack.ss_sp == NULL || sigaltstack(&stack, NULL) != 0) {
+        perror("sigaltstack");
+        exit(1);
+    }
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = diff_crash_handler;
+    action.sa_flags = SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, NULL);
+    sigaction(SIGBUS, &action, NULL);
+    sigaction(SIGILL, &action, NULL);
+    sigaction(SIGFPE, &action, NULL);
+}
+
+void diff_native(struct diff_target *t, struct diff_slot *s)
+{
+    unsigned int args[4];
+    
+    memcpy(s->native_buf, s->in.buf, s->in.len);
+    diff_args(t, &s->in, s->native_buf, args);
+    // sigsetjmp saves the signal mask, so the handler's signal is unblocked again
+    s->signal = sigsetjmp(diff_crash_jump, 1);
+    if (s->signal != 0)
+        return;
+    s->native_result = ((diff_native_func) t->func)(args[0], args[1], args[2], args[3]);
+}
+
+int diff_compare(struct diff_slot *s)
+{
+    if (s->fault != FAULT_NONE)
+        return DIFF_FAULT;
+    if (s->signal != 0)
+        return DIFF_CRASH;
+    if (s->emu_result != s->native_result)
+        return DIFF_RESULT;
+    if (memcmp(s->emu_buf, s->native_buf, s->in.len) != 0)
+        return DIFF_MEMORY;
+    if (s->native_result != s->c_result)
+        return DIFF_REFERENCE;
+    return DIFF_OK;
+}
+
+// all three implementations on one input, the native code only if the emulator finished
+int diff_check(struct diff_worker *w, struct diff_slot *s)
+{
+    diff_emulate(w, s);
+    if (s->fault != FAULT_NONE)
+        return DIFF_FAULT;
+    diff_native(w->target, s);
+    s->c_result = w->target->reference(&s->in);
+    return diff_compare(s);
+}
+
+// shorter buffers first, then values closer to zero (to 'a' in strings)
+unsigned long long diff_size(struct diff_target *t, struct fuzz_input *in)
+{
+    unsigned long long size = 0;
+    int i;
+    
+    for (i = 0; i < 4; i++) {
+        size += llabs((int) in->args[i]);
+    }
+    if (t->kind == FUZZ_STRING) {
+        for (i = 0; i < in->len; i++) {
+            size += abs(in->buf[i] - 'a');
+        }
+    } else {
+        for (i = 0; i + 4 <= in->len; i += 4) {
+            size += llabs(*((int *) &in->buf[i]));
+        }
+    }
+    return ((unsigned long long) in->len << 48) + size;
+}
+
+// keeps the candidate if it is smaller and fails the same way
+bool diff_try(struct diff_worker *w, struct diff_slot *failing, int class, int *tries)
+{
+    struct diff_slot *c = &w->candidate;
+    
+    diff_normalize(w->target, &c->in);
+    if (*tries >= DIFF_MIN_TRIES || diff_size(w->target, &c->in) >= diff_size(w->target, &failing->in))
+        return false;
+    (*tries)++;
+    if (diff_check(w, c) != class)
+        return false;
+    *failing = *c;
+    return true;
+}
+
+// a value and the steps that take it towards target
+int diff_shrink_steps(int value, int target, int *steps)
+{
+    steps[0] = target;
+    steps[1] = target + (value - target) / 2;
+    steps[2] = value - (value > target ? 1 : -1);
+    return 3;
+}
+
+/* Greedy minimization: drops spans of the buffer, then moves arguments and
+   elements towards zero, until nothing smaller fails the same way.
+   Returns the checks it took. */
+int diff_minimize(struct diff_worker *w, struct diff_slot *failing, int class)
+{
+    struct diff_target *t = w->target;
+    struct diff_slot *c = &w->candidate;
+    int unit = t->kind == FUZZ_STRING ? 1 : 4;
+    int steps[3];
+    int tries = 0;
+    int chunk;
+    int pos;
+    int i;
+    int k;
+    bool progress = true;
+    
+    while (progress && tries < DIFF_MIN_TRIES) {
+        progress = false;
+        for (chunk = failing->in.len / 2; chunk >= unit; chunk /= 2) {
+            chunk -= chunk % unit;
+            pos = 0;
+            while (pos + chunk <= failing->in.len) {
+                c->in = failing->in;
+                memmove(&c->in.buf[pos], &c->in.buf[pos + chunk], c->in.len - pos - chunk);
+                c->in.len -= chunk;
+                if (diff_try(w, failing, class, &tries))
+                    progress = true;
+                else
+                    pos += chunk;
+            }
+        }
+        for (i = 0; i < 4; i++) {
+            for (k = 0; failing->in.args[i] != 0 && k < diff_shrink_steps(failing->in.args[i], 0, steps); k++) {
+                c->in = failing->in;
+                c->in.args[i] = steps[k];
+                if (diff_try(w, failing, class, &tries)) {
+                    progress = true;
+                    k = -1;
+                }
+            }
+        }
+        for (pos = 0; pos + unit <= failing->in.len; pos += unit) {
+            if (t->kind == FUZZ_STRING) {
+                for (k = 0; failing->in.buf[pos] != 'a' && k < diff_shrink_steps(failing->in.buf[pos], 'a', steps); k++) {
+                    c->in = failing->in;
+                    c->in.buf[pos] = steps[k];
+                    if (diff_try(w, failing, class, &tries)) {
+                        progress = true;
+                        k = -1;
+                    }
+                }
+            } else {
+                for (k = 0; *((int *) &failing->in.buf[pos]) != 0 && k < diff_shrink_steps(*((int *) &failing->in.buf[pos]), 0, steps); k++) {
+                    c->in = failing->in;
+                    *((int *) &c->in.buf[pos]) = steps[k];
+                    if (diff_try(w, failing, class, &tries)) {
+                        progress = true;
+                        k = -1;
+                    }
+                }
+            }
+        }
+    }
+    return tries;
+}
+
+void diff_report(struct diff_worker *w, struct diff_slot *s, int class, int tries)
+{
+    int i;
+    
+    printf("[worker %d] %s %s, minimized in %d checks: r0-r3 = %d %d %d %d, buffer %d bytes",
+           w->id, w->target->name, diff_names[class], tries,
+           s->in.args[0], s->in.args[1], s->in.args[2], s->in.args[3], s->in.len);
+    for (i = 0; i < s->in.len && i < 64; i++) {
+        printf("%s%02x", i % 4 == 0 ? " " : "", s->in.buf[i]);
+    }
+    if (class == DIFF_FAULT)
+        printf(", fault %d\n", s->fault);
+    else if (class == DIFF_CRASH)
+        printf(", armemu = %d, native died of signal %d\n", s->emu_result, s->signal);
+    else
+        printf(", armemu = %d, native = %d, c = %d\n", s->emu_result, s->native_result, s->c_result);
+}
+
+void diff_target_run(struct diff_worker *w, struct diff_target *t, unsigned long long checks)
+{
+    struct arm_state *state = &w->machine->state;
+    struct diff_slot *s;
+    unsigned int code_lo;
+    unsigned int code_hi;
+    struct timespec start;
+    struct timespec end;
+    unsigned long long done;
+    int class;
+    int tries;
+    int n;
+    int j;
+    
+    code_lo = (unsigned int) diff_targets[0].func;
+    code_hi = code_lo;
+    for (j = 0; j < DIFF_NTARGETS; j++) {
+        if ((unsigned int) diff_targets[j].func < code_lo)
+            code_lo = (unsigned int) diff_targets[j].func;
+        if ((unsigned int) diff_targets[j].func > code_hi)
+            code_hi = (unsigned int) diff_targets[j].func;
+    }
+    
+    w->target = t;
+    w->reported = 0;
+    arm_state_init(state, &w->machine->cache, t->func, 0, 0, 0, 0);
+    state->budget = FUZZ_BUDGET;
+    state->check_mem = true;
+    state->code_lo = code_lo;
+    state->code_hi = code_hi + 1024;
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (done = 0; done < checks; done += n) {
+        n = checks - done < DIFF_BATCH ? checks - done : DIFF_BATCH;
+        for (j = 0; j < n; j++) {
+            diff_generate(w, &w->batch[j].in);
+        }
+        // each implementation runs over the whole batch at a time, so its
+        // code and the host's branch predictors stay warm
+        for (j = 0; j < n; j++) {
+            diff_emulate(w, &w->batch[j]);
+        }
+        for (j = 0; j < n; j++) {
+            if (w->batch[j].fault == FAULT_NONE)
+                diff_native(t, &w->batch[j]);
+        }
+        for (j = 0; j < n; j++) {
+            w->batch[j].c_result = t->reference(&w->batch[j].in);
+        }
+        for (j = 0; j < n; j++) {
+            s = &w->batch[j];
+            class = diff_compare(s);
+            w->stats->checks++;
+            if (class == DIFF_OK)
+                continue;
+            w->stats->failures[class]++;
+            if (w->reported < FUZZ_REPORTS) {
+                w->reported++;
+                tries = diff_minimize(w, s, class);
+                diff_report(w, s, class, tries);
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    w->stats->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/* Co-simulates every target with one forked worker per core; stats come
+   back through a shared mapping. Workers catch crashes in the native code
+   and report them like any other failure, so a worker that still dies
+   crashed in the emulator or the harness. */
+void execute_diff(int c_size, unsigned long long checks)
+{
+    struct diff_stats *stats;
+    struct diff_stats total;
+    struct diff_worker *w;
+    double rate;
+    double all_rate = 0;
+    int nworkers;
+    int status;
+    int i;
+    int k;
+    int c;
+    
+    nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nworkers < 1)
+        nworkers = 1;
+    if (nworkers > FUZZ_MAX_WORKERS)
+        nworkers = FUZZ_MAX_WORKERS;
+    
+    stats = mmap(NULL, sizeof(struct diff_stats) * nworkers * DIFF_NTARGETS, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (stats == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    memset(stats, 0, sizeof(struct diff_stats) * nworkers * DIFF_NTARGETS);
+    
+    printf("-- Co-simulating with %d workers, %llu checks per target per worker --\n", nworkers, checks);
+    fflush(stdout);
+    
+    for (i = 0; i < nworkers; i++) {
+        if (fork() == 0) {
+            w = malloc(sizeof(struct diff_worker));
+            w->id = i;
+            w->machine = new_machine(c_size);
+            diff_catch_crashes();
+            w->rng = 0x9E3779B9 * (i + 1) ^ (unsigned int) time(NULL);
+            if (w->rng == 0)
+                w->rng = 1;
+            for (k = 0; k < DIFF_NTARGETS; k++) {
+                w->stats = &stats[i * DIFF_NTARGETS + k];
+                diff_target_run(w, &diff_targets[k], checks);
+                fflush(stdout);
+            }
+            exit(0);
+        }
+    }
+    for (i = 0; i < nworkers; i++) {
+        wait(&status);
+        if (WIFSIGNALED(status))
+            printf("a worker was killed by signal %d\n", WTERMSIG(status));
+    }
+    
+    for (k = 0; k < DIFF_NTARGETS; k++) {
+        memset(&total, 0, sizeof(total));
+        rate = 0;
+        for (i = 0; i < nworkers; i++) {
+            struct diff_stats *s = &stats[i * DIFF_NTARGETS + k];
+            total.checks += s->checks;
+            for (c = 0; c < DIFF_CLASSES; c++) {
+                total.failures[c] += s->failures[c];
+            }
+            if (s->seconds > 0)
+                rate += s->checks / s->seconds;
+        }
+        all_rate += rate;
+        printf("\n%s\n", diff_targets[k].name);
+        printf("Checks: %llu (%0.0f per second)\n", total.checks, rate);
+        for (c = DIFF_FAULT; c < DIFF_CLASSES; c++) {
+            printf("%c%s: %llu\n", diff_names[c][0] - 'a' + 'A', diff_names[c] + 1, total.failures[c]);
+        }
+    }
+    printf("\nAll targets: %0.0f checks per second\n", all_rate / DIFF_NTARGETS);
+    
+    munmap(stats, sizeof(struct diff_stats) * nworkers * DIFF_NTARGETS);
+}
+
+/* Superinstructions: the six workloads, profiled with -p and timed with
+   and without the generated superinstructions with -u */
+
+#define SUPER_ELEMENTS 100000
+
+struct super_workload {
+    char *name;
+    unsigned int *func;
+    unsigned int args[4];
+    int runs;
+};
+
+struct super_totals {
+    unsigned int result;
+    unsigned long long counts[5];
+    unsigned long long cache[3];
+    unsigned long long dispatches;
+    double seconds;
+};
+
+int super_workloads(struct super_workload *w, int *array, char *str)
+{
+    struct super_workload all[] = {
+        {"quadratic", (unsigned int *) quadratic_a, {2, 3, 4, 5}, 200000},
+        {"sum_array", (unsigned int *) sum_array_a, {(unsigned int) array, SUPER_ELEMENTS, 0, 0}, 20},
+        {"find_max", (unsigned int *) find_max_a, {(unsigned int) array, SUPER_ELEMENTS, 0, 0}, 20},
+        {"fib_iter", (unsigned int *) fib_iter_a, {46, 0, 0, 0}, 50000},
+        {"fib_rec", (unsigned int *) fib_rec_a, {20, 0, 0, 0}, 10},
+        {"strlen", (unsigned int *) strlen_a, {(unsigned int) str, 0, 0, 0}, 20},
+    };
+    int i;
+    
+    for (i = 0; i < SUPER_ELEMENTS; i++) {
+        array[i] = (i * 37) % 1000 - 500;
+    }
+    memset(str, 'a', SUPER_ELEMENTS);
+    str[SUPER_ELEMENTS] = 0;
+    memcpy(w, all, sizeof(all));
+    return sizeof(all) / sizeof(all[0]);
+}
+
+// runs w->runs times, with a profile or superinstructions if they aren't NULL
+void super_workload_run(struct armemu_machine *machine, struct super_workload *w,
+                        struct super_profile *profile, struct super_cache *super, struct super_totals *t)
+{
+    struct arm_state *state = &machine->state;
+    struct direct_mapped_cache *cache = &machine->cache;
+    struct timespec start;
+    struct timespec end;
+    int i;
+    
+    memset(t, 0, sizeof(struct super_totals));
+    for (i = 0; i < w->runs; i++) {
+        arm_state_init(state, cache, w->func, w->args[0], w->args[1], w->args[2], w->args[3]);
+        state->profile = profile;
+        state->super = super;
+        if (super != NULL)
+            super->dispatches = 0;
+        
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        t->result = armemu(state, cache);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        t->seconds += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        
+        t->counts[0] += state->computation_count;
+        t->counts[1] += state->memory_count;
+        t->counts[2] += state->memory_words;
+        t->counts[3] += state->branch_taken;
+        t->counts[4] += state->branch_not_taken;
+        t->cache[0] += cache->requests;
+        t->cache[1] += cache->cache_hit;
+        t->cache[2] += cache->cache_miss;
+        t->dispatches += super != NULL ? super->dispatches : instruction_total(state);
+    }
+}
+
+void execute_super_profile(int c_size, char *path)
+{
+    struct armemu_machine *machine = new_machine(c_size);
+    struct super_workload w[8];
+    struct super_profile *profile;
+    struct super_totals t;
+    char *names[SOP_COUNT] = SUPER_OPCODE_NAMES;
+    int *array = malloc(SUPER_ELEMENTS * sizeof(int));
+    char *str = malloc(SUPER_ELEMENTS + 1);
+    FILE *out;
+    int nworkloads;
+    int i;
+    int j;
+    int k;
+    
+    profile = calloc(1, sizeof(struct super_profile));
+    nworkloads = super_workloads(w, array, str);
+    for (i = 0; i < nworkloads; i++) {
+        super_workload_run(machine, &w[i], profile, NULL, &t);
+    }
+    
+    out = fopen(path, "w");
+    if (out == NULL) {
+        perror(path);
+        exit(1);
+    }
+    // one line per pair and triple that ran, the input of armsuper
+    fprintf(out, "# opcode pairs and triples of");
+    for (i = 0; i < nworkloads; i++) {
+        fprintf(out, " %s", w[i].name);
+    }
+    fprintf(out, "\n");
+    for (i = 0; i < SOP_COUNT; i++) {
+        for (j = 0; j < SOP_COUNT; j++) {
+            if (profile->pairs[i][j] != 0)
+                fprintf(out, "pair %llu %s %s\n", profile->pairs[i][j], names[i], names[j]);
+            for (k = 0; k < SOP_COUNT; k++) {
+                if (profile->triples[i][j][k] != 0)
+                    fprintf(out, "triple %llu %s %s %s\n", profile->triples[i][j][k], names[i], names[j], names[k]);
+            }
+        }
+    }
+    fclose(out);
+    printf("Profile of %d workloads written to %s\n", nworkloads, path);
+    
+    free(profile);
+    free(array);
+    free(str);
+    armemu_destroy(machine);
+}
+
+void execute_super(int c_size)
+{
+    struct armemu_machine *machine = new_machine(c_size);
+    struct super_workload w[8];
+    struct super_cache *super;
+    struct super_totals t[2];
+    unsigned long long instructions;
+    unsigned long long all_instructions = 0;
+    unsigned long long all_dispatches = 0;
+    double all_seconds[2] = {0, 0};
+    int *array = malloc(SUPER_ELEMENTS * sizeof(int));
+    char *str = malloc(SUPER_ELEMENTS + 1);
+    int nworkloads;
+    bool same;
+    int i;
+    
+    super = calloc(1, sizeof(struct super_cache));
+    nworkloads = super_workloads(w, array, str);
+    
+    printf("-- Superinstructions, %d generated --\n\n", armemu_super_patterns());
+    printf("%-10s %12s %12s %7s %9s %9s %8s  %s\n", "workload", "instructions", "dispatches", "fewer", "plain s", "super s", "speedup", "counters");
+    for (i = 0; i < nworkloads; i++) {
+        super_workload_run(machine, &w[i], NULL, NULL, &t[0]);
+        super_workload_run(machine, &w[i], NULL, super, &t[1]);
+        
+        same = t[0].result == t[1].result
+            && memcmp(t[0].counts, t[1].counts, sizeof(t[0].counts)) == 0
+            && memcmp(t[0].cache, t[1].cache, sizeof(t[0].cache)) == 0;
+        instructions = t[0].dispatches;
+        all_instructions += instructions;
+        all_dispatches += t[1].dispatches;
+        all_seconds[0] += t[0].seconds;
+        all_seconds[1] += t[1].seconds;
+        
+        printf("%-10s %12llu %12llu %6.1f%% %9.3f %9.3f %7.2fx  %s\n", w[i].name, instructions, t[1].dispatches,
+               100.0 * (instructions - t[1].dispatches) / instructions,
+               t[0].seconds, t[1].seconds, t[0].seconds / t[1].seconds, same ? "identical" : "DIFFERENT");
+    }
+    printf("%-10s %12llu %12llu %6.1f%% %9.3f %9.3f %7.2fx\n\n", "all", all_instructions, all_dispatches,
+           100.0 * (all_instructions - all_dispatches) / all_instructions,
+           all_seconds[0], all_seconds[1], all_seconds[0] / all_seconds[1]);
+    
+    free(super);
+    free(array);
+    free(str);
+    armemu_destroy(machine);
+}
+
+int check_cache_size(int num)
+{
+    if(num > 7 && num < pow(2, 10)) {
+        if((num & (num - 1)) == 0)
+            return num;
+    }
+    return 8;
+}
+
+int main(int argc, char **argv)
+{
+    
+    int num;
+    int size;
+    int i;
+    char c[] = "-c";
+    char f[] = "-f";
+    char a[] = "-a";
+    char l[] = "-l";
+    char d[] = "-d";
+    char t[] = "-t";
+    char n[] = "-i";
+    char m[] = "-s";
+    char x[] = "-x";
+    char p[] = "-p";
+    char u[] = "-u";
+    char *aot_path = NULL;
+    char *profile_path = NULL;
+    bool loops = false;
+    bool decode = false;
+    bool super = false;
+    int telemetry_runs = 0;
+    int instances = 0;
+    int contexts = 0;
+    unsigned long long fuzz_iterations = 0;
+    unsigned long long diff_checks = 0;
+
+    size = 8;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], l)==0) {
+            loops = true;
+        } else if (strcmp(argv[i], d)==0) {
+            decode = true;
+        } else if (strcmp(argv[i], u)==0) {
+            super = true;
+        } else if (i + 1 == argc) {
+            break;
+        } else if (strcmp(argv[i], c)==0) {
+            num = atoi(argv[++i]);
+            size = check_cache_size(num);
+        } else if (strcmp(argv[i], f)==0) {
+            fuzz_iterations = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], x)==0) {
+            diff_checks = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], a)==0) {
+            aot_path = argv[++i];
+        } else if (strcmp(argv[i], p)==0) {
+            profile_path = argv[++i];
+        } else if (strcmp(argv[i], t)==0) {
+            telemetry_runs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], n)==0) {
+            instances = atoi(argv[++i]);
+        } else if (strcmp(argv[i], m)==0) {
+            contexts = atoi(argv[++i]);
+        }
+    }
+
+    if (contexts > 0) {
+        execute_sched(size, contexts);
+        return 0;
+    }
+
+    if (instances > 0) {
+        execute_instances(size, instances);
+        return 0;
+    }
+
+    if (telemetry_runs > 0) {
+        execute_telemetry(size, telemetry_runs);
+        return 0;
+    }
+
+    if (decode) {
+        execute_decode(size);
+        return 0;
+    }
+
+    if (loops) {
+        execute_loops(size);
+        return 0;
+    }
+
+    if (aot_path != NULL) {
+        execute_aot(size, aot_path);
+        return 0;
+    }
+
+    if (profile_path != NULL) {
+        execute_super_profile(size, profile_path);
+        return 0;
+    }
+
+    if (super) {
+        execute_super(size);
+        return 0;
+    }
+
+    if (fuzz_iterations > 0) {
+        execute_fuzz(size, fuzz_iterations);
+        return 0;
+    }
+
+    if (diff_checks > 0) {
+        execute_diff(size, diff_checks);
+        return 0;
+    }
+
+    execute_quadratic(size);
+    
+    execute_sum_array(size);
+
+    execute_find_max(size);
+
+    execute_fib_iter(size);
+    
+    execute_fib_rec(size);
     
     execute_strlen(size);
+
+    execute_dot_product(size);
    
     return 0;
 }
@@ -0,0 +1,411 @@
+/* libarmemu: emulates ARM functions on an ARM host.
+
+   A machine is created from a configuration, optionally inside an arena
+   that many machines share, runs any number of guest functions and is
+   destroyed. Machines share nothing, so different threads may run
+   different machines at the same time. The library has no globals and
+   does no I/O. The structures below are public so drivers can inspect
+   and tune a machine between runs. */
+
+#ifndef ARMEMU_H
+#define ARMEMU_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "armaot.h"
+
+#define NREGS 16
+#define STACK_SIZE 1024     // default guest stack in bytes
+#define SP 13
+#define LR 14
+#define PC 15
+
+#define COV_MAP_SIZE 65536
+
+/* Instruction classes, see classify_inst */
+#define INST_UNDEFINED 0
+#define INST_NEON 1
+#define INST_VFP 2
+#define INST_BX 3
+#define INST_BRANCH 4
+#define INST_MUL 5
+#define INST_DATA_PROCESSING 6
+#define INST_SINGLE_DATA_TRANSFER 7
+#define INST_BLOCK_DATA_TRANSFER 8
+
+#define DECODE_MAX 256
+#define DECODE_REGIONS 64   // regions of DECODE_MAX words a decode cache keeps
+
+#define LOOP_SLOTS 64
+#define LOOP_HOT 16
+#define TRACE_MAX 64
+
+#define MEMO_SLOTS 1024
+#define MEMO_READS 8        // words a memoized call may read outside its frame
+#define MEMO_DEPTH 32       // nested calls recorded at once
+
+/* Opcodes of superinstruction profiles and patterns, see super_opcode */
+#define SOP_SUB 0
+#define SOP_ADD 1
+#define SOP_CMP 2
+#define SOP_MOV 3
+#define SOP_DP 4            // other data processing, which only counts
+#define SOP_MUL 5
+#define SOP_BEQ 6           // b<cond> is SOP_BEQ + cond, up to ble
+#define SOP_B 20
+#define SOP_BL 21
+#define SOP_BX 22
+#define SOP_LDR 23
+#define SOP_STR 24
+#define SOP_LDRB 25
+#define SOP_STRB 26
+#define SOP_LDM 27
+#define SOP_STM 28
+#define SOP_VFP 29
+#define SOP_NEON 30
+#define SOP_UNDEFINED 31
+#define SOP_COUNT 32
+
+#define SUPER_OPCODE_NAMES {"sub", "add", "cmp", "mov", "dp", "mul", \
+    "beq", "bne", "bcs", "bcc", "bmi", "bpl", "bvs", "bvc", "bhi", "bls", "bge", "blt", "bgt", "ble", \
+    "b", "bl", "bx", "ldr", "str", "ldrb", "strb", "ldm", "stm", "vfp", "neon", "undefined"}
+
+#define SUPER_MAX 3         // instructions in a superinstruction
+#define SUPER_SLOTS 1024
+
+#define TRACE_DP 0
+#define TRACE_MUL 1
+#define TRACE_SDT 2
+#define TRACE_BRANCH 3
+
+/* Reasons armemu() stopped before the function returned */
+#define FAULT_NONE 0
+#define FAULT_UNDEFINED 1
+#define FAULT_MEMORY 2
+#define FAULT_HANG 3
+#define FAULT_YIELD 4       // the time slice ran out, call armemu() again to carry on
+
+/* Decoded fields of a run of instruction words, one array per field */
+struct decoded_words {
+    unsigned char kind[DECODE_MAX];
+    unsigned char rd[DECODE_MAX];
+    unsigned char rn[DECODE_MAX];
+    unsigned char rm[DECODE_MAX];
+    unsigned char end[DECODE_MAX];  // 1 where a basic block ends
+};
+
+/* Instruction classes of the code a machine has run. The first time the
+   PC enters an aligned region of DECODE_MAX words, decode_words classifies
+   the whole region at once and the interpreter reads the classes from
+   here instead of testing each word. */
+struct decode_region {
+    unsigned int base;          // address of the first word, 0 while empty
+    unsigned char kind[DECODE_MAX];
+};
+
+struct decode_cache {
+    struct decode_region regions[DECODE_REGIONS];
+    unsigned long long decoded; // regions decoded
+};
+
+/* One predecoded instruction of a loop trace */
+struct trace_op {
+    unsigned int pc;
+    unsigned int iw;
+    unsigned char kind;
+    unsigned char opcode;
+    unsigned char rd;
+    unsigned char rn;
+    unsigned char rm;
+    unsigned char i_bit;
+    bool taken;                 // direction the guard expects
+    unsigned int imm;
+    unsigned int target;
+    unsigned int comp;          // counts of the ops before this one in the body
+    unsigned int mem;
+    unsigned int taken_count;
+    unsigned int not_taken_count;
+};
+
+struct loop_trace {
+    unsigned int head;          // target of the backward branch
+    unsigned int count;         // times the backward branch was taken
+    bool compiled;
+    bool failed;                // the body can't be traced or isn't stable
+    bool cache_private;         // no two body instructions share a cache slot
+    int cache_size;
+    int n;
+    struct trace_op ops[TRACE_MAX];
+    unsigned int comp;          // counts for one whole iteration
+    unsigned int mem;
+    unsigned int taken;
+    unsigned int not_taken;
+    unsigned int entries;
+    unsigned int iterations;
+};
+
+struct loop_cache {
+    struct loop_trace loops[LOOP_SLOTS];
+    struct loop_trace *recording;
+    struct loop_trace *pending;     // trace to run next, set at a backward branch
+};
+
+/* Counters a call moves, taken at the call and again at the return */
+struct memo_counts {
+    unsigned int comp;
+    unsigned int mem;
+    unsigned int mem_words;
+    unsigned int taken;
+    unsigned int not_taken;
+    int cache_requests;
+    int cache_hits;
+    int cache_misses;
+};
+
+/* A completed pure call: its key (target, r0-r3, the words it read
+   outside its own frame and, if any of those were on the stack, sp) and
+   what it left in the registers */
+struct memo_entry {
+    bool valid;
+    unsigned int target;
+    unsigned int args[4];
+    unsigned int sp;
+    bool reads_stack;           // sp is part of the key
+    int nreads;
+    unsigned int read_addr[MEMO_READS];
+    unsigned int read_val[MEMO_READS];
+    unsigned int out[4];        // r0-r3 at the return
+    unsigned int r12;
+    unsigned int lr;
+    bool lr_is_return;          // lr held the return address, as after bx lr
+    int flags[4];
+    struct memo_counts delta;
+};
+
+/* A call being recorded */
+struct memo_frame {
+    unsigned int target;
+    unsigned int sp;            // sp at the call, the callee's frame is below it
+    unsigned int lr;            // return address
+    unsigned int regs[13];      // r0-r12 at the call
+    bool pure;
+    int nreads;
+    unsigned int read_addr[MEMO_READS];
+    unsigned int read_val[MEMO_READS];
+    struct memo_counts start;
+};
+
+struct memo_cache {
+    struct memo_entry entries[MEMO_SLOTS];
+    struct memo_frame frames[MEMO_DEPTH];
+    int depth;
+    bool called;                // the last instruction was a taken bl
+    unsigned long long calls;
+    unsigned long long hits;
+    unsigned long long recorded;
+    unsigned long long impure;  // calls that stored outside their frame or used VFP/NEON
+};
+
+/* How often each opcode pair and triple ran at consecutive addresses */
+struct super_profile {
+    unsigned long long pairs[SOP_COUNT][SOP_COUNT];
+    unsigned long long triples[SOP_COUNT][SOP_COUNT][SOP_COUNT];
+    unsigned int prev_pc[2];    // the last two instructions, most recent first
+    int prev_op[2];
+};
+
+/* One predecoded instruction of a superinstruction */
+struct super_op {
+    unsigned int iw;
+    unsigned char opcode;
+    unsigned char rd;
+    unsigned char rn;
+    unsigned char rm;
+    unsigned char i_bit;
+    unsigned int imm;
+    unsigned int target;        // branches
+};
+
+struct super_slot {
+    unsigned int pc;
+    int pattern;                // superinstruction starting at pc, -1 to interpret one instruction
+    struct super_op ops[SUPER_MAX];
+};
+
+/* Decoded instructions by address, each either the start of a
+   superinstruction or a single instruction */
+struct super_cache {
+    struct super_slot slots[SUPER_SLOTS];
+    unsigned long long dispatches;
+    unsigned long long fused;   // instructions run inside superinstructions
+};
+
+/* The complete machine state */
+struct arm_state {
+    unsigned int regs[NREGS];
+    unsigned char *stack;       // grows down from stack + stack_size
+    unsigned int stack_size;
+    int n_flag;
+    int z_flag;
+    int c_flag;
+    int v_flag;
+    /* VFP/NEON registers: s0-s31 alias d0-d15, q0-q15 alias pairs of d0-d31 */
+    union {
+        unsigned int s[64];
+        float f[64];
+        unsigned long long d[32];
+        double df[32];
+    } vfp __attribute__((aligned(16)));
+    unsigned int fpscr;
+    unsigned int computation_count;
+    unsigned int memory_count;
+    unsigned int memory_words;  // words moved by memory instructions, ldm/stm move several
+    unsigned int branch_taken;
+    unsigned int branch_not_taken;
+    unsigned int fault;
+    unsigned int budget;        // max instructions per run, 0 for no limit
+    unsigned int stack_low;     // lowest stack address written, used by arm_state_reset
+    bool check_mem;             // fault on accesses outside the stack, guest buffer and code
+    unsigned int mem_lo;
+    unsigned int mem_hi;
+    unsigned int code_lo;
+    unsigned int code_hi;
+    unsigned char *cov_map;     // AFL-style edge coverage bitmap, NULL when not fuzzing
+    unsigned short *cov_dirty;  // indices of cov_map entries that went from 0 to 1
+    unsigned int cov_ndirty;
+    unsigned int cov_prev;
+    struct aot_code *aot;       // translated functions to run instead of interpreting, or NULL; unused with a slice
+    struct loop_cache *loops;   // hot loop traces, NULL to interpret every instruction
+    struct memo_cache *memo;    // results of pure calls, NULL to run every call
+    struct super_profile *profile;  // opcode pair and triple counts, or NULL
+    struct super_cache *super;  // superinstructions, NULL to dispatch every instruction
+    struct decode_cache *decode;    // bulk decoded instruction classes, NULL to classify each word
+    struct telemetry *telem;    // live counters in shared memory, or NULL
+    unsigned int telem_countdown;
+    unsigned int slice;         // instructions per armemu() call before yielding, 0 for no limit
+    unsigned int slice_end;
+};
+
+struct cache_slot {
+    unsigned int v;
+    unsigned int tag;
+};
+
+struct direct_mapped_cache {
+    struct cache_slot *slots;
+    int cache_hit;
+    int cache_miss;
+    int requests;
+    int size;               // slots in use, at most capacity
+    int capacity;
+    int *dirty;             // slots made valid since the last init/reset
+    int ndirty;
+};
+
+struct telemetry;
+struct armemu_arena;
+
+/* Options fixed when a machine is created; armemu_configure can change
+   cache_size (up to the size created with), budget and check_mem later */
+struct armemu_config {
+    unsigned int stack_size;    // guest stack in bytes
+    int cache_size;             // instruction cache slots, a power of 2
+    bool guard_page;            // an inaccessible page below the stack
+    unsigned int budget;        // max instructions per run, 0 for no limit
+    bool check_mem;             // fault on accesses outside the stack and code
+    unsigned int code_lo;       // code range for check_mem
+    unsigned int code_hi;
+};
+
+/* A machine and the memory it owns. The stack, cache slots and this
+   structure are one block, from the arena or a mapping of its own. */
+struct armemu_machine {
+    struct arm_state state;
+    struct direct_mapped_cache cache;
+    struct armemu_arena *arena;     // NULL when the block is its own mapping
+    struct armemu_machine *next;    // free list of the arena
+    void *block;
+    size_t block_size;
+    bool guard_page;
+};
+
+/* Results of the last run */
+struct armemu_stats {
+    unsigned int result;        // r0
+    unsigned int fault;
+    unsigned int computation;
+    unsigned int memory;
+    unsigned int memory_words;
+    unsigned int branch_taken;
+    unsigned int branch_not_taken;
+    int cache_requests;
+    int cache_hits;
+    int cache_misses;
+    unsigned int stack_used;    // bytes below the top of the stack written
+};
+
+
+/* Machine API */
+void armemu_config_default(struct armemu_config *config);
+struct armemu_arena *armemu_arena_create(size_t size, bool huge);
+bool armemu_arena_huge(struct armemu_arena *arena);
+size_t armemu_arena_used(struct armemu_arena *arena);
+void armemu_arena_destroy(struct armemu_arena *arena);
+struct armemu_machine *armemu_create(struct armemu_arena *arena, struct armemu_config *config);
+bool armemu_configure(struct armemu_machine *m, struct armemu_config *config);
+unsigned int armemu_run(struct armemu_machine *m, unsigned int *func, unsigned int arg0, unsigned int arg1, unsigned int arg2, unsigned int arg3);
+void armemu_start(struct armemu_machine *m, unsigned int *func, unsigned int arg0, unsigned int arg1, unsigned int arg2, unsigned int arg3);
+void armemu_query(struct armemu_machine *m, struct armemu_stats *stats);
+void armemu_destroy(struct armemu_machine *m);
+
+/* Scheduler API, see armsched.c */
+#define ARMEMU_PRIORITIES 4
+
+struct armemu_sched;
+
+/* A guest context for the scheduler. The caller owns it and its machine
+   and fills in machine and priority; the rest is the scheduler's. */
+struct armemu_task {
+    struct armemu_machine *machine;
+    int priority;                   // 0 is the highest
+    bool done;
+    unsigned int slices;            // times it was dispatched
+    unsigned long long ready_ns;    // when it was last queued
+    unsigned long long wait_ns;     // total time queued
+    unsigned long long max_wait_ns;
+    struct armemu_task *next;
+};
+
+struct armemu_sched_stats {
+    unsigned long long dispatches;
+    unsigned long long steals;
+    unsigned long long instructions;
+    unsigned long long finished;
+    unsigned long long run_ns;          // time workers spent inside armemu()
+};
+
+struct armemu_sched *armemu_sched_create(int nworkers, unsigned int slice);
+void armemu_sched_submit(struct armemu_sched *s, struct armemu_task *t);
+bool armemu_sched_start(struct armemu_sched *s);
+void armemu_sched_wait(struct armemu_sched *s);
+void armemu_sched_stats(struct armemu_sched *s, struct armemu_sched_stats *stats);
+void armemu_sched_destroy(struct armemu_sched *s);
+
+/* Lower level interface the machine API is built on */
+void arm_state_init(struct arm_state *as, struct direct_mapped_cache *cache, unsigned int *func, unsigned int arg0, unsigned int arg1, unsigned int arg2, unsigned int arg3);
+void arm_state_reset(struct arm_state *as, struct direct_mapped_cache *cache, unsigned int *func, unsigned int arg0, unsigned int arg1, unsigned int arg2, unsigned int arg3);
+unsigned int armemu(struct arm_state *state, struct direct_mapped_cache *cache);
+unsigned int instruction_total(struct arm_state *state);
+int classify_inst(unsigned int iw);
+int super_opcode(unsigned int iw);
+int armemu_super_patterns(void);
+int decode_words_scalar(unsigned int *words, int n, struct decoded_words *out);
+int decode_words(unsigned int *words, int n, struct decoded_words *out);
+bool aot_load(struct aot_code *aot, char *path);
+void aot_unload(struct aot_code *aot);
+struct telemetry *telemetry_create(char *name);
+void telemetry_destroy(struct telemetry *t, char *name);
+void telemetry_publish(struct telemetry *t, struct arm_state *state, struct direct_mapped_cache *cache);
+
+#endif
@@ -0,0 +1,152 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+
+#include "armtelem.h"
+
+/* Telemetry monitor: maps the segment a running './armemu -t N' publishes
+   in /dev/shm/armemu.PID and prints one line per interval with the guest MIPS,
+   instruction mix, cache hit rate and branch statistics over that
+   interval. It only reads the segment, so it can come and go while the
+   emulator runs. */
+
+/* Copies a consistent snapshot of the counters out of the seqlock */
+void snapshot(struct telem_segment *seg, struct telem_counters *c)
+{
+    unsigned int seq;
+
+    do {
+        seq = seg->seq;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        c->computation = seg->c.computation;
+        c->memory = seg->c.memory;
+        c->memory_words = seg->c.memory_words;
+        c->branch_taken = seg->c.branch_taken;
+        c->branch_not_taken = seg->c.branch_not_taken;
+        c->cache_requests = seg->c.cache_requests;
+        c->cache_hits = seg->c.cache_hits;
+        c->cache_misses = seg->c.cache_misses;
+        c->runs = seg->c.runs;
+        c->time_ns = seg->c.time_ns;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != seg->seq);
+}
+
+double percent(unsigned long long part, unsigned long long whole)
+{
+    return whole == 0 ? 0 : 100.0 * part / whole;
+}
+
+void print_interval(struct telem_counters *prev, struct telem_counters *cur)
+{
+    unsigned long long comp = cur->computation - prev->computation;
+    unsigned long long mem = cur->memory - prev->memory;
+    unsigned long long taken = cur->branch_taken - prev->branch_taken;
+    unsigned long long not_taken = cur->branch_not_taken - prev->branch_not_taken;
+    unsigned long long total = comp + mem + taken + not_taken;
+    unsigned long long requests = cur->cache_requests - prev->cache_requests;
+    unsigned long long hits = cur->cache_hits - prev->cache_hits;
+    double seconds = (cur->time_ns - prev->time_ns) / 1e9;
+
+    printf("%10.1f %6.1f %6.1f %7.1f %6.1f %6.1f %10.2f %6llu\n",
+           seconds > 0 ? total / seconds / 1e6 : 0.0,
+           percent(comp, total), percent(mem, total), percent(taken + not_taken, total),
+           percent(taken, taken + not_taken), percent(hits, requests),
+           (double) (cur->memory_words - prev->memory_words) / (mem == 0 ? 1 : mem),
+           cur->runs);
+}
+
+/* The pid of the only running emulator with a segment in /dev/shm, 0 if
+   there is none and -1 if there are several. With list set each one is
+   printed. */
+int find_writer(bool list)
+{
+    DIR *dir;
+    struct dirent *e;
+    int found = 0;
+    int pid;
+    
+    dir = opendir("/dev/shm");
+    if (dir == NULL)
+        return 0;
+    while ((e = readdir(dir)) != NULL) {
+        if (sscanf(e->d_name, TELEM_NAME_FORMAT + 1, &pid) != 1 || kill(pid, 0) != 0)
+            continue;
+        if (list)
+            fprintf(stderr, "  ./armemu pid %d\n", pid);
+        found = found == 0 ? pid : -1;
+    }
+    closedir(dir);
+    return found;
+}
+
+int main(int argc, char **argv)
+{
+    struct telem_segment *seg;
+    struct telem_counters prev;
+    struct telem_counters cur;
+    int interval_ms = 1000;
+    int pid = 0;
+    int fd;
+    int i;
+    char n[] = "-n";
+    char p[] = "-p";
+    char name[TELEM_NAME_MAX];
+
+    // -n sets the sampling interval in milliseconds, -p the emulator to watch
+    for (i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], n) == 0)
+            interval_ms = atoi(argv[++i]);
+        else if (strcmp(argv[i], p) == 0)
+            pid = atoi(argv[++i]);
+    }
+    if (pid == 0)
+        pid = find_writer(false);
+    if (pid == 0) {
+        fprintf(stderr, "no running ./armemu -t N found\n");
+        return 1;
+    }
+    if (pid < 0) {
+        fprintf(stderr, "several emulators are running, pick one with -p PID:\n");
+        find_writer(true);
+        return 1;
+    }
+
+    snprintf(name, sizeof(name), TELEM_NAME_FORMAT, pid);
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        fprintf(stderr, "no /dev/shm%s, start ./armemu -t N first\n", name);
+        return 1;
+    }
+    seg = mmap(NULL, sizeof(struct telem_segment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    printf("guest MIPS  comp%%   mem%% branch%% taken%% cache%%  words/mem   runs\n");
+    snapshot(seg, &prev);
+    while (seg->pid != 0 && kill(seg->pid, 0) == 0) {
+        usleep(interval_ms * 1000);
+        snapshot(seg, &cur);
+        if (cur.time_ns == prev.time_ns)
+            continue;
+        // nothing published yet when the monitor started
+        if (prev.time_ns == 0) {
+            prev = cur;
+            continue;
+        }
+        print_interval(&prev, &cur);
+        prev = cur;
+    }
+
+    munmap(seg, sizeof(struct telem_segment));
+    return 0;
+}
@@ -0,0 +1,354 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "armemu.h"
+
+/* M:N scheduler: many guest contexts over a fixed pool of host threads.
+   A context is a machine, registers plus the stack it owns, so a switch
+   is armemu() returning at a preemption point and being called on
+   another machine; no host stacks are saved or restored. Each worker has
+   a FIFO run queue per priority and takes the highest priority context
+   first, except that every SCHED_AGE picks it takes the lowest, so low
+   priorities still make progress. A worker with nothing to run steals
+   from the others, and sleeps on a condition variable when there is
+   nothing to steal either. */
+
+#define SCHED_AGE 8
+
+struct run_queue {
+    struct armemu_task *head;
+    struct armemu_task *tail;
+};
+
+struct sched_worker {
+    pthread_spinlock_t lock;
+    struct run_queue queues[ARMEMU_PRIORITIES];
+    int queued;                 // tasks in queues, read without the lock by thieves
+    unsigned int picks;
+    int id;
+    pthread_t thread;
+    struct armemu_sched *sched;
+    struct armemu_sched_stats stats;
+} __attribute__((aligned(64)));     // workers don't share cache lines
+
+struct armemu_sched {
+    struct sched_worker *workers;
+    int nworkers;
+    int started;                // worker threads running, the rest's queues are only stolen from
+    unsigned int slice;
+    int live;                   // submitted tasks that haven't finished
+    int queued;                 // tasks in all the run queues
+    int next;                   // worker the next submitted task goes to
+    pthread_mutex_t lock;       // idle, stopping and the wakeups below
+    pthread_cond_t work;        // a task was queued, or the scheduler is stopping
+    int idle;                   // workers waiting on work
+    bool stopping;              // armemu_sched_wait was called, exit once live is 0
+};
+
+static unsigned long long sched_now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void run_queue_push(struct run_queue *q, struct armemu_task *t)
+{
+    t->next = NULL;
+    if (q->tail == NULL)
+        q->head = t;
+    else
+        q->tail->next = t;
+    q->tail = t;
+}
+
+static struct armemu_task *run_queue_take(struct run_queue *q)
+{
+    struct armemu_task *t = q->head;
+
+    if (t != NULL) {
+        q->head = t->next;
+        if (q->head == NULL)
+            q->tail = NULL;
+    }
+    return t;
+}
+
+/* Wakes an idle worker if there is one. A worker counts itself idle
+   before it checks s->queued for the last time and queueing counts the
+   task before reading s->idle, so one of the two always sees the other. */
+static void sched_wake(struct armemu_sched *s)
+{
+    if (__atomic_load_n(&s->idle, __ATOMIC_SEQ_CST) == 0)
+        return;
+    pthread_mutex_lock(&s->lock);
+    pthread_cond_signal(&s->work);
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void sched_push(struct sched_worker *w, struct armemu_task *t)
+{
+    pthread_spin_lock(&w->lock);
+    run_queue_push(&w->queues[t->priority], t);
+    w->queued++;
+    pthread_spin_unlock(&w->lock);
+    __atomic_add_fetch(&w->sched->queued, 1, __ATOMIC_SEQ_CST);
+    sched_wake(w->sched);
+}
+
+// takes the next task of w, the caller holds w->lock
+static struct armemu_task *sched_take(struct sched_worker *w, bool lowest_first)
+{
+    struct armemu_task *t = NULL;
+    int p;
+
+    if (lowest_first) {
+        for (p = ARMEMU_PRIORITIES - 1; p >= 0 && t == NULL; p--) {
+            t = run_queue_take(&w->queues[p]);
+        }
+    } else {
+        for (p = 0; p < ARMEMU_PRIORITIES && t == NULL; p++) {
+            t = run_queue_take(&w->queues[p]);
+        }
+    }
+    if (t != NULL) {
+        w->queued--;
+        __atomic_sub_fetch(&w->sched->queued, 1, __ATOMIC_SEQ_CST);
+    }
+    return t;
+}
+
+static struct armemu_task *sched_pop(struct sched_worker *w)
+{
+    struct armemu_task *t;
+
+    if (__atomic_load_n(&w->queued, __ATOMIC_RELAXED) == 0)
+        return NULL;
+    pthread_spin_lock(&w->lock);
+    t = sched_take(w, ++w->picks % SCHED_AGE == 0);
+    pthread_spin_unlock(&w->lock);
+    return t;
+}
+
+// takes the highest priority task of the first other worker that has one
+static struct armemu_task *sched_steal(struct sched_worker *w)
+{
+    struct armemu_sched *s = w->sched;
+    struct sched_worker *victim;
+    struct armemu_task *t;
+    int i;
+
+    for (i = 1; i < s->nworkers; i++) {
+        victim = &s->workers[(w->id + i) % s->nworkers];
+        if (__atomic_load_n(&victim->queued, __ATOMIC_RELAXED) == 0)
+            continue;
+        pthread_spin_lock(&victim->lock);
+        t = sched_take(victim, false);
+        pthread_spin_unlock(&victim->lock);
+        if (t != NULL) {
+            w->stats.steals++;
+            return t;
+        }
+    }
+    return NULL;
+}
+
+/* Sleeps until a task is queued, false once the scheduler is stopping
+   and every task is done */
+static bool sched_idle(struct armemu_sched *s)
+{
+    bool more = true;
+
+    pthread_mutex_lock(&s->lock);
+    __atomic_add_fetch(&s->idle, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&s->queued, __ATOMIC_SEQ_CST) == 0) {
+        if (s->stopping && __atomic_load_n(&s->live, __ATOMIC_ACQUIRE) == 0) {
+            more = false;
+            break;
+        }
+        pthread_cond_wait(&s->work, &s->lock);
+    }
+    __atomic_sub_fetch(&s->idle, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&s->lock);
+    return more;
+}
+
+static void *sched_worker_main(void *arg)
+{
+    struct sched_worker *w = arg;
+    struct armemu_sched *s = w->sched;
+    struct armemu_task *t;
+    struct arm_state *state;
+    unsigned long long now;
+    unsigned int before;
+
+    for (;;) {
+        t = sched_pop(w);
+        if (t == NULL)
+            t = sched_steal(w);
+        if (t == NULL) {
+            if (!sched_idle(s))
+                break;
+            continue;
+        }
+
+        now = sched_now_ns();
+        t->wait_ns += now - t->ready_ns;
+        if (now - t->ready_ns > t->max_wait_ns)
+            t->max_wait_ns = now - t->ready_ns;
+
+        state = &t->machine->state;
+        state->slice = s->slice;
+        before = instruction_total(state);
+        armemu(state, &t->machine->cache);
+        t->ready_ns = sched_now_ns();
+        w->stats.run_ns += t->ready_ns - now;
+        w->stats.instructions += instruction_total(state) - before;
+        w->stats.dispatches++;
+        t->slices++;
+
+        if (state->fault == FAULT_YIELD) {
+            sched_push(w, t);
+            continue;
+        }
+        t->done = true;
+        w->stats.finished++;
+        // the last task lets idle workers see that a stopping scheduler is done
+        if (__atomic_sub_fetch(&s->live, 1, __ATOMIC_RELEASE) == 0) {
+            pthread_mutex_lock(&s->lock);
+            pthread_cond_broadcast(&s->work);
+            pthread_mutex_unlock(&s->lock);
+        }
+    }
+    return NULL;
+}
+
+/* Creates a scheduler with nworkers host threads, not started yet. Each
+   dispatch runs a context for about slice instructions; it yields at the
+   first taken branch after that. NULL on failure. */
+struct armemu_sched *armemu_sched_create(int nworkers, unsigned int slice)
+{
+    struct armemu_sched *s;
+    int i;
+    int p;
+
+    if (nworkers < 1 || slice == 0)
+        return NULL;
+    s = malloc(sizeof(struct armemu_sched));
+    if (s == NULL)
+        return NULL;
+    if (posix_memalign((void **) &s->workers, 64, nworkers * sizeof(struct sched_worker)) != 0) {
+        free(s);
+        return NULL;
+    }
+    memset(s->workers, 0, nworkers * sizeof(struct sched_worker));
+    s->nworkers = nworkers;
+    s->started = 0;
+    s->slice = slice;
+    s->live = 0;
+    s->queued = 0;
+    s->next = 0;
+    s->idle = 0;
+    s->stopping = false;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->work, NULL);
+
+    for (i = 0; i < nworkers; i++) {
+        pthread_spin_init(&s->workers[i].lock, PTHREAD_PROCESS_PRIVATE);
+        for (p = 0; p < ARMEMU_PRIORITIES; p++) {
+            s->workers[i].queues[p].head = NULL;
+            s->workers[i].queues[p].tail = NULL;
+        }
+        s->workers[i].id = i;
+        s->workers[i].sched = s;
+    }
+    return s;
+}
+
+/* Queues a task whose machine was set up with armemu_start. Tasks are
+   spread over the workers round robin; submitting is allowed while the
+   scheduler runs, up to armemu_sched_wait. */
+void armemu_sched_submit(struct armemu_sched *s, struct armemu_task *t)
+{
+    struct sched_worker *w;
+
+    if (t->priority < 0)
+        t->priority = 0;
+    if (t->priority >= ARMEMU_PRIORITIES)
+        t->priority = ARMEMU_PRIORITIES - 1;
+    t->done = false;
+    t->slices = 0;
+    t->wait_ns = 0;
+    t->max_wait_ns = 0;
+    t->ready_ns = sched_now_ns();
+
+    __atomic_add_fetch(&s->live, 1, __ATOMIC_RELEASE);
+    w = &s->workers[__atomic_fetch_add(&s->next, 1, __ATOMIC_RELAXED) % s->nworkers];
+    sched_push(w, t);
+}
+
+/* Starts the worker threads, which run tasks until armemu_sched_wait.
+   False if some threads could not be created; the ones that did start
+   steal the tasks queued on the others, and if none started
+   armemu_sched_wait runs the tasks on the calling thread. */
+bool armemu_sched_start(struct armemu_sched *s)
+{
+    int i;
+
+    for (i = 0; i < s->nworkers; i++) {
+        if (pthread_create(&s->workers[i].thread, NULL, sched_worker_main, &s->workers[i]) != 0)
+            return false;
+        s->started++;
+    }
+    return true;
+}
+
+/* Waits until every submitted task is done and stops the workers. No
+   tasks may be submitted after this is called. */
+void armemu_sched_wait(struct armemu_sched *s)
+{
+    int i;
+
+    pthread_mutex_lock(&s->lock);
+    s->stopping = true;
+    pthread_cond_broadcast(&s->work);
+    pthread_mutex_unlock(&s->lock);
+
+    if (s->started == 0)
+        sched_worker_main(&s->workers[0]);
+    for (i = 0; i < s->started; i++) {
+        pthread_join(s->workers[i].thread, NULL);
+    }
+}
+
+// totals over all workers, call after armemu_sched_wait
+void armemu_sched_stats(struct armemu_sched *s, struct armemu_sched_stats *stats)
+{
+    int i;
+
+    memset(stats, 0, sizeof(struct armemu_sched_stats));
+    for (i = 0; i < s->nworkers; i++) {
+        stats->dispatches += s->workers[i].stats.dispatches;
+        stats->steals += s->workers[i].stats.steals;
+        stats->instructions += s->workers[i].stats.instructions;
+        stats->finished += s->workers[i].stats.finished;
+        stats->run_ns += s->workers[i].stats.run_ns;
+    }
+}
+
+void armemu_sched_destroy(struct armemu_sched *s)
+{
+    int i;
+
+    for (i = 0; i < s->nworkers; i++) {
+        pthread_spin_destroy(&s->workers[i].lock);
+    }
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->work);
+    free(s->workers);
+    free(s);
+}
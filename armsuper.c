@@ -0,0 +1,291 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "armemu.h"
+
+/* Superinstruction generator: reads the opcode pair and triple counts
+   that './armemu -p FILE' writes and emits armsuper_gen.c, which
+   libarmemu.c includes. The runs that would save the most dispatches
+   become one handler each; every handler does what armemu_one would do
+   for each of its instructions, with the decoding already done and a
+   cmp feeding a conditional branch compared directly. Only straight
+   line code is fused: a branch may end a run but nothing that can't be
+   predecoded (bl, bx, ldm/stm, VFP/NEON) may be part of one. */
+
+#define MAX_CANDIDATES 4096
+#define MAX_PATTERNS 16
+
+struct candidate {
+    int n;
+    int ops[SUPER_MAX];
+    unsigned long long count;
+};
+
+char *opcode_names[SOP_COUNT] = SUPER_OPCODE_NAMES;
+
+/* Branch conditions when the flags come from cmp a, b */
+char *cmp_cond_expr[] = {
+    "a == b", "a != b", "a >= b", "a < b",
+    "(int) (a - b) < 0", "(int) (a - b) >= 0", "state->v_flag == 1", "state->v_flag == 0",
+    "a > b", "a <= b", "(int) a >= (int) b", "(int) a < (int) b",
+    "(int) a > (int) b", "(int) a <= (int) b",
+};
+
+int opcode_number(char *name)
+{
+    int i;
+
+    for (i = 0; i < SOP_COUNT; i++) {
+        if (strcmp(opcode_names[i], name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+bool is_branch(int op)
+{
+    return op >= SOP_BEQ && op <= SOP_B;
+}
+
+// only branches end a run, and bl/bx/ldm/stm/VFP/NEON aren't predecoded
+bool fusable(struct candidate *c)
+{
+    int i;
+
+    for (i = 0; i < c->n; i++) {
+        if (is_branch(c->ops[i])) {
+            if (i != c->n - 1)
+                return false;
+        } else if (!(c->ops[i] <= SOP_MUL || (c->ops[i] >= SOP_LDR && c->ops[i] <= SOP_STRB))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// dispatches the candidate would save
+unsigned long long saving(struct candidate *c)
+{
+    return c->count * (c->n - 1);
+}
+
+int by_saving(const void *x, const void *y)
+{
+    unsigned long long a = saving((struct candidate *) x);
+    unsigned long long b = saving((struct candidate *) y);
+
+    return a < b ? 1 : (a > b ? -1 : 0);
+}
+
+// longest first, so the interpreter takes the longest run that matches
+int by_length(const void *x, const void *y)
+{
+    struct candidate *a = (struct candidate *) x;
+    struct candidate *b = (struct candidate *) y;
+
+    if (a->n != b->n)
+        return b->n - a->n;
+    return by_saving(x, y);
+}
+
+int read_profile(FILE *in, struct candidate *cands)
+{
+    char line[256];
+    char kind[16];
+    char names[SUPER_MAX][16];
+    unsigned long long count;
+    struct candidate *c;
+    int n = 0;
+    int fields;
+    int i;
+
+    while (fgets(line, sizeof(line), in) != NULL) {
+        if (line[0] == '#')
+            continue;
+        fields = sscanf(line, "%15s %llu %15s %15s %15s", kind, &count, names[0], names[1], names[2]);
+        if (fields < 4 || n == MAX_CANDIDATES)
+            continue;
+        c = &cands[n];
+        c->n = strcmp(kind, "triple") == 0 ? 3 : 2;
+        if (fields != c->n + 2)
+            continue;
+        c->count = count;
+        for (i = 0; i < c->n; i++) {
+            c->ops[i] = opcode_number(names[i]);
+            if (c->ops[i] < 0)
+                break;
+        }
+        if (i == c->n && fusable(c))
+            n++;
+    }
+    return n;
+}
+
+void print_name(FILE *out, struct candidate *c)
+{
+    int i;
+
+    fprintf(out, "super");
+    for (i = 0; i < c->n; i++) {
+        fprintf(out, "_%s", opcode_names[c->ops[i]]);
+    }
+}
+
+void emit_op(FILE *out, struct candidate *c, int k)
+{
+    int op = c->ops[k];
+    bool cmp_branch = op == SOP_CMP && k + 1 < c->n && is_branch(c->ops[k + 1]) && c->ops[k + 1] != SOP_B;
+
+    fprintf(out, "    simulate_cache(cache, r[PC]);\n");
+    switch(op)
+    {
+        case SOP_SUB:
+            fprintf(out, "    r[ops[%d].rd] = r[ops[%d].rn] - super_operand(state, &ops[%d]);\n", k, k, k);
+            break;
+        case SOP_ADD:
+            fprintf(out, "    r[ops[%d].rd] = r[ops[%d].rn] + super_operand(state, &ops[%d]);\n", k, k, k);
+            break;
+        case SOP_CMP:
+            if (cmp_branch) {
+                fprintf(out, "    a = r[ops[%d].rn];\n    b = super_operand(state, &ops[%d]);\n", k, k);
+                fprintf(out, "    set_cpsr_flags(state, a, b);\n");
+            } else {
+                fprintf(out, "    set_cpsr_flags(state, r[ops[%d].rn], super_operand(state, &ops[%d]));\n", k, k);
+            }
+            break;
+        case SOP_MOV:
+            fprintf(out, "    r[ops[%d].rd] = super_operand(state, &ops[%d]);\n", k, k);
+            break;
+        case SOP_DP:
+            break;
+        case SOP_MUL:
+            fprintf(out, "    r[ops[%d].rd] = r[ops[%d].rm] * r[ops[%d].rn];\n", k, k, k);
+            break;
+        case SOP_LDR:
+        case SOP_STR:
+        case SOP_LDRB:
+        case SOP_STRB:
+            fprintf(out, "    if (!super_sdt(state, &ops[%d]))\n        return;\n", k);
+            return;
+        case SOP_B:
+            fprintf(out, "    super_branch(state, &ops[%d], true);\n", k);
+            return;
+        default:
+            if (k > 0 && c->ops[k - 1] == SOP_CMP)
+                fprintf(out, "    super_branch(state, &ops[%d], %s);\n", k, cmp_cond_expr[op - SOP_BEQ]);
+            else
+                fprintf(out, "    super_branch(state, &ops[%d], condition_flags(state, ops[%d].iw));\n", k, k);
+            return;
+    }
+    fprintf(out, "    state->computation_count++;\n");
+    fprintf(out, "    r[PC] = r[PC] + 4;\n");
+}
+
+void emit_handler(FILE *out, struct candidate *c)
+{
+    int k;
+
+    fprintf(out, "/* ");
+    for (k = 0; k < c->n; k++) {
+        fprintf(out, "%s%s", k == 0 ? "" : ", ", opcode_names[c->ops[k]]);
+    }
+    fprintf(out, ": %llu in the profile */\n", c->count);
+    fprintf(out, "static void ");
+    print_name(out, c);
+    fprintf(out, "(struct arm_state *state, struct direct_mapped_cache *cache, struct super_op *ops)\n{\n");
+    fprintf(out, "    unsigned int *r = state->regs;\n");
+    for (k = 0; k + 1 < c->n; k++) {
+        if (c->ops[k] == SOP_CMP && is_branch(c->ops[k + 1]) && c->ops[k + 1] != SOP_B) {
+            fprintf(out, "    unsigned int a;\n    unsigned int b;\n");
+            break;
+        }
+    }
+    fprintf(out, "\n");
+    for (k = 0; k < c->n; k++) {
+        emit_op(out, c, k);
+    }
+    fprintf(out, "}\n\n");
+}
+
+void emit_patterns(FILE *out, struct candidate *cands, int n)
+{
+    char *p;
+    int op;
+    int i;
+    int k;
+
+    fprintf(out, "/* Generated by armsuper from a profile of the workloads, do not edit.\n");
+    fprintf(out, "   Regenerate with 'make super'. */\n\n");
+    for (i = 0; i < n; i++) {
+        emit_handler(out, &cands[i]);
+    }
+
+    fprintf(out, "static const struct super_pattern super_patterns[] = {\n");
+    for (i = 0; i < n; i++) {
+        fprintf(out, "    {%d, {", cands[i].n);
+        for (k = 0; k < cands[i].n; k++) {
+            op = cands[i].ops[k];
+            fprintf(out, "%sSOP_", k == 0 ? "" : ", ");
+            if (op > SOP_BEQ && op < SOP_B) {
+                fprintf(out, "BEQ + %d", op - SOP_BEQ);
+                continue;
+            }
+            // otherwise SOP_ names are the opcode names in capitals
+            for (p = opcode_names[op]; *p != '\0'; p++) {
+                fputc(*p - 'a' + 'A', out);
+            }
+        }
+        fprintf(out, "}, ");
+        print_name(out, &cands[i]);
+        fprintf(out, "},\n");
+    }
+    if (n == 0)
+        fprintf(out, "    {0, {0}, NULL},\n");
+    fprintf(out, "};\n\n");
+    fprintf(out, "static const int super_npatterns = %d;\n", n);
+}
+
+int main(int argc, char **argv)
+{
+    struct candidate *cands;
+    FILE *in;
+    int max = MAX_PATTERNS;
+    int n;
+    int i;
+    char m[] = "-n";
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s [-n patterns] PROFILE > armsuper_gen.c\n", argv[0]);
+        return 1;
+    }
+    // -n sets how many superinstructions to generate
+    for (i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], m) == 0)
+            max = atoi(argv[++i]);
+    }
+    in = fopen(argv[argc - 1], "r");
+    if (in == NULL) {
+        perror(argv[argc - 1]);
+        return 1;
+    }
+
+    cands = malloc(MAX_CANDIDATES * sizeof(struct candidate));
+    n = read_profile(in, cands);
+    fclose(in);
+
+    qsort(cands, n, sizeof(struct candidate), by_saving);
+    if (n > max)
+        n = max;
+    qsort(cands, n, sizeof(struct candidate), by_length);
+    emit_patterns(stdout, cands, n);
+
+    for (i = 0; i < n; i++) {
+        print_name(stderr, &cands[i]);
+        fprintf(stderr, ": saves %llu dispatches\n", saving(&cands[i]));
+    }
+
+    free(cands);
+    return 0;
+}
@@ -0,0 +1,302 @@
+/* Generated by armsuper from a profile of the workloads, do not edit.
+   Regenerate with 'make super'. */
+
+/* add, add, b: 4250540 in the profile */
+static void super_add_add_b(struct arm_state *state, struct direct_mapped_cache *cache, struct super_op *ops)
+{
+    unsigned int *r = state->regs;
+
+    simulate_cache(cache, r[PC]);
+    r[ops[0].rd] = r[ops[0].rn] + super_operand(state, &ops[0]);
+    state->computation_count++;
+    r[PC] = r[PC] + 4;
+    simulate_cache(cache, r[PC]);
+    r[ops[1].rd] = r[ops[1].rn] + super_operand(state, &ops[1]);
+    state->computation_count++;
+    r[PC] = r[PC] + 4;
+    simulate_cache(cache, r[PC]);
+    super_branch(state, &ops[2], true);
+}
+
+/* mov, add, add: 2250540 in the profile */
+static void super_mov_add_add(struct arm_state *state, struct direct_mapped_cache *cache, struct super_op *ops)
+{
+    unsigned int *r = state->regs;
+
+    simulate_cache(cache, r[PC]);
+    r[ops[0].rd] = super_operand(state, &ops[0]);
+    state->computation_count++;
+    r[PC] = r[PC] + 4;
+    simulate_cache(cache, r[PC]);
+    r[ops[1].rd] = r[ops[1].rn] + super_operand(state, &ops[1]);
+    state->computation_count++;
+    r[PC] = r[PC] + 4;
+    simulate_cache(cache, r[PC]);
+    r[ops[2].rd] = r[ops[2].rn] + super_operand(state, &ops[2]);
+    state->computation_count++;
+    r[PC] = r[PC] + 4;
+}
+
+/* mov, mov, add: 2250000 in the profile */
+static void super_mov_mov_add(struct arm_state *state, struct direct_mapped_cache *cache, struct super_op *ops)
+{
+    unsigned int *r = state->regs;
+
+    simulate_cache(cache, r[PC]);
+    r[ops[0].rd] = super_operand(state, &ops[0]);
+    state->computation_count++;
+    r[PC] = r[PC] + 4;
+    simulate_cache(cache, r[PC]);
+    r[ops[1].rd] = super_operand(state, &ops[1]);
+    state->computation_count++;
+    r[PC] = r[PC] + 4;
+    simulate_cache(cache, r[PC]);
+    r[ops[2].rd] = r[ops[2].rn] + super_operand(state, &ops[2]);
+    state->computation_count++;
+    r[PC] = r[PC] + 4;
+}
+
+/* ldrb, cmp, beq: 2000020 in the profile */
+static void super_ldrb_cmp_beq(struct arm_state *state, struct direct_mapped_cache *cache, struct super_op *ops)
+{
+    unsigned int *r = state->regs;
+    unsigned int a;
+    unsigned int b;
+
+    simulate_cache(cache, r[PC]);
+    if (!super_sdt(state, &ops[0]))
+        return;
+    simulate_cache(cache, r[PC]);
+    a = r[ops[1].rn];
+    b = super_operand(state, &ops[1]);
+    set_cpsr_flags(state, a, b);
+    state->computation_count++;
+    r[PC] = r[PC] + 4;
+    simulate_cache(cache, r[PC]);
+    super_branch(state, &ops[2], a == b);
+}
+
+/* add, add, cmp: 2000000 in the profile */
+static void super_add_add_cmp(struct arm_state *state, struct direct_mapped_cache *cache, struct super_op *ops)
+{
+    unsigned int *r = state->regs;
+
+    simulate_cache(cache, r[PC]);
+    r[ops[0].rd] = r[ops[0].rn] + super_operand(state, &ops[0]);
+    state->computation_count++;
+    r[PC] = r[PC] + 4;
+    simulate_cache(cache, r[PC]);
+    r[ops[1].rd] = r[ops[1].rn] + super_operand(state, &ops[1]);
+    state->computation_count++;
+    r[PC] = r[PC] + 4;
+    simulate_cache(cache, r[PC]);
+    set_cpsr_flags(state, r[ops[2].rn], super_operand(state, &ops[2]));
+    state->computation_count++;
+    r[PC] = r[PC] + 4;
+}
+
+/* add, cmp, bne: 2000000 in the profile */
+static void super_add_cmp_bne(struct arm_state *state, struct direct_mapped_cache *cache, struct super_op *ops)
+{
+    unsigned int *r = state->regs;
+    unsigned int a;
+    unsigned int b;
+
+    simulate_cache(cache, r[PC]);
+    r[ops[0].rd] = r[ops[0].rn] + super_operand(state, &ops[0]);
+    state->computation_count++;
+    r[PC] = r[PC] + 4;
+    simulate_cache(cache, r[PC]);
+    a = r[ops[1].rn];
+    b = super_operand(state, &ops[1]);
+    set_cpsr_flags(state, a, b);
+    state->computation_count++;
+    r[PC] = r[PC] + 4;
+    simulate_cache(cache, r[PC]);
+    super_branch(state, &ops[2], a != b);
+}
+
+/* ldr, add, add: 2000000 in the profile */
+static void super_ldr_add_add(struct arm_state *state, struct direct_mapped_cache *cache, struct super_op *ops)
+{
+    unsigned int *r = state->regs;
+
+    simulate_cache(cache, r[PC]);
+    if (!super_sdt(state, &ops[0]))
+        return;
+    simulate_cache(cache, r[PC]);
+    r[ops[1].rd] = r[ops[1].rn] + super_operand(state, &ops[1]);
+    state->computation_count++;
+    r[PC] = r[PC] + 4;
+    simulate_cache(cache, r[PC]);
+    r[ops[2].rd] = r[ops[2].rn] + super_operand(state, &ops[2]);
+    state->computation_count++;
+    r[PC] = r[PC] + 4;
+}
+
+/* ldr, cmp, bgt: 1999980 in the profile */
+static void super_ldr_cmp_bgt(struct arm_state *state, struct direct_mapped_cache *cache, struct super_op *ops)
+{
+    unsigned int *r = state->regs;
+    unsigned int a;
+    unsigned int b;
+
+    simulate_cache(cache, r[PC]);
+    if (!super_sdt(state, &ops[0]))
+        return;
+    simulate_cache(cache, r[PC]);
+    a = r[ops[1].rn];
+    b = super_operand(state, &ops[1]);
+    set_cpsr_flags(state, a, b);
+    state->computation_count++;
+    r[PC] = r[PC] + 4;
+    simulate_cache(cache, r[PC]);
+    super_branch(state, &ops[2], (int) a > (int) b);
+}
+
+/* ldr, ldr, cmp: 1999980 in the profile */
+static void super_ldr_ldr_cmp(struct arm_state *state, struct direct_mapped_cache *cache, struct super_op *ops)
+{
+    unsigned int *r = state->regs;
+
+    simulate_cache(cache, r[PC]);
+    if (!super_sdt(state, &ops[0]))
+        return;
+    simulate_cache(cache, r[PC]);
+    if (!super_sdt(state, &ops[1]))
+        return;
+    simulate_cache(cache, r[PC]);
+    set_cpsr_flags(state, r[ops[2].rn], super_operand(state, &ops[2]));
+    state->computation_count++;
+    r[PC] = r[PC] + 4;
+}
+
+/* add, add, str: 1999440 in the profile */
+static void super_add_add_str(struct arm_state *state, struct direct_mapped_cache *cache, struct super_op *ops)
+{
+    unsigned int *r = state->regs;
+
+    simulate_cache(cache, r[PC]);
+    r[ops[0].rd] = r[ops[0].rn] + super_operand(state, &ops[0]);
+    state->computation_count++;
+    r[PC] = r[PC] + 4;
+    simulate_cache(cache, r[PC]);
+    r[ops[1].rd] = r[ops[1].rn] + super_operand(state, &ops[1]);
+    state->computation_count++;
+    r[PC] = r[PC] + 4;
+    simulate_cache(cache, r[PC]);
+    if (!super_sdt(state, &ops[2]))
+        return;
+}
+
+/* add, str, b: 1999440 in the profile */
+static void super_add_str_b(struct arm_state *state, struct direct_mapped_cache *cache, struct super_op *ops)
+{
+    unsigned int *r = state->regs;
+
+    simulate_cache(cache, r[PC]);
+    r[ops[0].rd] = r[ops[0].rn] + super_operand(state, &ops[0]);
+    state->computation_count++;
+    r[PC] = r[PC] + 4;
+    simulate_cache(cache, r[PC]);
+    if (!super_sdt(state, &ops[1]))
+        return;
+    simulate_cache(cache, r[PC]);
+    super_branch(state, &ops[2], true);
+}
+
+/* add, add: 8449980 in the profile */
+static void super_add_add(struct arm_state *state, struct direct_mapped_cache *cache, struct super_op *ops)
+{
+    unsigned int *r = state->regs;
+
+    simulate_cache(cache, r[PC]);
+    r[ops[0].rd] = r[ops[0].rn] + super_operand(state, &ops[0]);
+    state->computation_count++;
+    r[PC] = r[PC] + 4;
+    simulate_cache(cache, r[PC]);
+    r[ops[1].rd] = r[ops[1].rn] + super_operand(state, &ops[1]);
+    state->computation_count++;
+    r[PC] = r[PC] + 4;
+}
+
+/* cmp, beq: 8350040 in the profile */
+static void super_cmp_beq(struct arm_state *state, struct direct_mapped_cache *cache, struct super_op *ops)
+{
+    unsigned int *r = state->regs;
+    unsigned int a;
+    unsigned int b;
+
+    simulate_cache(cache, r[PC]);
+    a = r[ops[0].rn];
+    b = super_operand(state, &ops[0]);
+    set_cpsr_flags(state, a, b);
+    state->computation_count++;
+    r[PC] = r[PC] + 4;
+    simulate_cache(cache, r[PC]);
+    super_branch(state, &ops[1], a == b);
+}
+
+/* add, b: 6250540 in the profile */
+static void super_add_b(struct arm_state *state, struct direct_mapped_cache *cache, struct super_op *ops)
+{
+    unsigned int *r = state->regs;
+
+    simulate_cache(cache, r[PC]);
+    r[ops[0].rd] = r[ops[0].rn] + super_operand(state, &ops[0]);
+    state->computation_count++;
+    r[PC] = r[PC] + 4;
+    simulate_cache(cache, r[PC]);
+    super_branch(state, &ops[1], true);
+}
+
+/* mov, mov: 2400040 in the profile */
+static void super_mov_mov(struct arm_state *state, struct direct_mapped_cache *cache, struct super_op *ops)
+{
+    unsigned int *r = state->regs;
+
+    simulate_cache(cache, r[PC]);
+    r[ops[0].rd] = super_operand(state, &ops[0]);
+    state->computation_count++;
+    r[PC] = r[PC] + 4;
+    simulate_cache(cache, r[PC]);
+    r[ops[1].rd] = super_operand(state, &ops[1]);
+    state->computation_count++;
+    r[PC] = r[PC] + 4;
+}
+
+/* mov, add: 2250540 in the profile */
+static void super_mov_add(struct arm_state *state, struct direct_mapped_cache *cache, struct super_op *ops)
+{
+    unsigned int *r = state->regs;
+
+    simulate_cache(cache, r[PC]);
+    r[ops[0].rd] = super_operand(state, &ops[0]);
+    state->computation_count++;
+    r[PC] = r[PC] + 4;
+    simulate_cache(cache, r[PC]);
+    r[ops[1].rd] = r[ops[1].rn] + super_operand(state, &ops[1]);
+    state->computation_count++;
+    r[PC] = r[PC] + 4;
+}
+
+static const struct super_pattern super_patterns[] = {
+    {3, {SOP_ADD, SOP_ADD, SOP_B}, super_add_add_b},
+    {3, {SOP_MOV, SOP_ADD, SOP_ADD}, super_mov_add_add},
+    {3, {SOP_MOV, SOP_MOV, SOP_ADD}, super_mov_mov_add},
+    {3, {SOP_LDRB, SOP_CMP, SOP_BEQ}, super_ldrb_cmp_beq},
+    {3, {SOP_ADD, SOP_ADD, SOP_CMP}, super_add_add_cmp},
+    {3, {SOP_ADD, SOP_CMP, SOP_BEQ + 1}, super_add_cmp_bne},
+    {3, {SOP_LDR, SOP_ADD, SOP_ADD}, super_ldr_add_add},
+    {3, {SOP_LDR, SOP_CMP, SOP_BEQ + 12}, super_ldr_cmp_bgt},
+    {3, {SOP_LDR, SOP_LDR, SOP_CMP}, super_ldr_ldr_cmp},
+    {3, {SOP_ADD, SOP_ADD, SOP_STR}, super_add_add_str},
+    {3, {SOP_ADD, SOP_STR, SOP_B}, super_add_str_b},
+    {2, {SOP_ADD, SOP_ADD}, super_add_add},
+    {2, {SOP_CMP, SOP_BEQ}, super_cmp_beq},
+    {2, {SOP_ADD, SOP_B}, super_add_b},
+    {2, {SOP_MOV, SOP_MOV}, super_mov_mov},
+    {2, {SOP_MOV, SOP_ADD}, super_mov_add},
+};
+
+static const int super_npatterns = 16;
@@ -0,0 +1,36 @@
+/* Live counters armemu publishes in shared memory and armmon reads */
+
+#ifndef ARMTELEM_H
+#define ARMTELEM_H
+
+#define TELEM_NAME_FORMAT "/armemu.%d"  // shm_open name from the writer's pid, /dev/shm/armemu.PID
+#define TELEM_NAME_MAX 32
+#define TELEM_INTERVAL (1 << 16)    // instructions between publishes
+
+/* Running totals over every armemu() call since the segment was created */
+struct telem_counters {
+    unsigned long long computation;
+    unsigned long long memory;
+    unsigned long long memory_words;
+    unsigned long long branch_taken;
+    unsigned long long branch_not_taken;
+    unsigned long long cache_requests;
+    unsigned long long cache_hits;
+    unsigned long long cache_misses;
+    unsigned long long runs;        // armemu() calls finished
+    unsigned long long time_ns;     // CLOCK_MONOTONIC when published
+};
+
+/* A seqlock with a single writer. The writer makes seq odd, writes the
+   counters and makes seq even again, with a store fence after the first
+   increment and before the second. A reader copies the counters between
+   two reads of seq and retries if seq was odd or changed. The counters
+   start on their own cache line so the reader's retries don't keep
+   pulling the line with seq away from the writer. */
+struct telem_segment {
+    volatile unsigned int seq __attribute__((aligned(64)));
+    volatile int pid;               // writer, 0 once it has exited
+    volatile struct telem_counters c __attribute__((aligned(64)));
+};
+
+#endif
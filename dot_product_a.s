@@ -0,0 +1,32 @@
+    .fpu neon
+    .global dot_product_a
+    .func dot_product_a
+
+    /* r0 - int *a */
+    /* r1 - int *b */
+    /* r2 - int n, a multiple of 4 */
+    /* r3 - int i */
+    /* q0 - four partial sums */
+
+dot_product_a:
+    veor q0, q0, q0
+    mov r3, #0
+
+loop:
+    cmp r3, r2
+    beq endloop
+    vld1.32 {d2, d3}, [r0]!
+    vld1.32 {d4, d5}, [r1]!
+    vmla.i32 q0, q1, q2
+    add r3, r3, #4
+    b loop
+
+endloop:
+    vmov.32 r0, d0[0]
+    vmov.32 r1, d0[1]
+    vmov.32 r2, d1[0]
+    vmov.32 r3, d1[1]
+    add r0, r0, r1
+    add r0, r0, r2
+    add r0, r0, r3
+    bx lr
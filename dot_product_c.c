@@ -0,0 +1,11 @@
+int dot_product_c(int *a, int *b, int n)
+{
+    int i;
+    int sum = 0;
+
+    for (i = 0; i < n; i++) {
+        sum = sum + a[i] * b[i];
+    }
+
+    return sum;
+}
@@ -13,6 +13,7 @@
 find_max_a:
     mov r2, #1
     mov r12, #0
+    ldr r3, [r0]    //max when the array has one element
 
 loop :
 
@@ -0,0 +1,2688 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <dlfcn.h>
+
+#include "armemu.h"
+#include "armtelem.h"
+
+/* Host vector types used for NEON registers */
+typedef unsigned char v16u8 __attribute__((vector_size(16)));
+typedef unsigned short v8u16 __attribute__((vector_size(16)));
+typedef unsigned int v4u32 __attribute__((vector_size(16)));
+typedef unsigned long long v2u64 __attribute__((vector_size(16)));
+typedef float v4f32 __attribute__((vector_size(16)));
+
+union neon_reg {
+    v16u8 b;
+    v8u16 h;
+    v4u32 w;
+    v2u64 q;
+    v4f32 f;
+};
+
+/* Words decoded per step: one AVX2 register, otherwise one NEON/SSE
+   register. Wider generic vectors get split badly on 128-bit hosts. */
+#ifdef __AVX2__
+#define DECODE_LANES 8
+#else
+#define DECODE_LANES 4
+#endif
+
+typedef unsigned int vdecode __attribute__((vector_size(DECODE_LANES * 4)));
+typedef unsigned char vdecode8 __attribute__((vector_size(DECODE_LANES)));
+
+/* Writer side of the telemetry segment */
+struct telemetry {
+    struct telem_segment *seg;
+    struct telem_counters done;     // totals of the armemu() calls that finished
+};
+
+/* Initialize an arm_state struct with a function pointer and arguments.
+   The stack and cache slots must already be attached, as armemu_create
+   does. */
+void arm_state_init(struct arm_state *as, struct direct_mapped_cache *cache, unsigned int *func, unsigned int arg0, unsigned int arg1, unsigned int arg2, unsigned int arg3)
+{
+    int i;
+    
+    // Zero out all arm state
+    for (i = 0; i < NREGS; i++) {
+        as->regs[i] = 0;
+    }
+    
+    // Zero out CPSR
+    as->n_flag = 0;
+    as->z_flag = 0;
+    as->c_flag = 0;
+    as->v_flag = 0;
+    
+    // Zero out the VFP/NEON registers and FPSCR
+    memset(&as->vfp, 0, sizeof(as->vfp));
+    as->fpscr = 0;
+    
+    // Zero out the stack
+    for (i = 0; i < as->stack_size; i++) {
+        as->stack[i] = 0;
+    }
+    
+    // Set the PC to point to the address of the function to emulate
+    as->regs[PC] = (unsigned int) func;
+    
+    // Set the SP to the top of the stack (the stack grows down)
+    as->regs[SP] = (unsigned int) &as->stack[as->stack_size];
+    
+    // Initialize LR to 0, this will be used to determine when the function has called bx lr
+    as->regs[LR] = 0;
+    
+    // Initialize the first 4 arguments
+    as->regs[0] = arg0;
+    as->regs[1] = arg1;
+    as->regs[2] = arg2;
+    as->regs[3] = arg3;
+    
+    // Initialize the instruction counts
+    as->computation_count = 0;
+    as->memory_count = 0;
+    as->memory_words = 0;
+    as->branch_taken = 0;
+    as->branch_not_taken = 0;
+    
+    // No fault, no budget and no fuzzing unless the caller asks for it
+    as->fault = FAULT_NONE;
+    as->budget = 0;
+    as->stack_low = (unsigned int) &as->stack[as->stack_size];
+    as->check_mem = false;
+    as->mem_lo = 0;
+    as->mem_hi = 0;
+    as->code_lo = 0;
+    as->code_hi = 0;
+    as->cov_map = NULL;
+    as->cov_dirty = NULL;
+    as->cov_ndirty = 0;
+    as->cov_prev = 0;
+    as->aot = NULL;
+    as->loops = NULL;
+    as->memo = NULL;
+    as->profile = NULL;
+    as->super = NULL;
+    as->decode = NULL;
+    as->telem = NULL;
+    as->telem_countdown = TELEM_INTERVAL;
+    as->slice = 0;
+    as->slice_end = 0;
+    
+    // Initialzies the Cache
+    cache->cache_hit = 0;
+    cache->cache_miss = 0;
+    cache->requests = 0;
+    cache->ndirty = 0;
+    
+    for (i = 0; i < cache->capacity; i++) {
+        cache->slots[i].v = 0;
+        cache->slots[i].tag = 0;
+    }
+}
+
+/* Reset an arm_state for another run of a function after arm_state_init.
+   Only the state the previous run dirtied is cleared: the part of the stack
+   below the lowest address written, the cache slots made valid and the
+   coverage entries hit. Configuration (budget, memory checks, coverage map)
+   is kept. */
+void arm_state_reset(struct arm_state *as, struct direct_mapped_cache *cache, unsigned int *func, unsigned int arg0, unsigned int arg1, unsigned int arg2, unsigned int arg3)
+{
+    unsigned int top;
+    int i;
+    
+    top = (unsigned int) &as->stack[as->stack_size];
+    memset((void *) as->stack_low, 0, top - as->stack_low);
+    as->stack_low = top;
+    
+    memset(as->regs, 0, sizeof(as->regs));
+    as->regs[PC] = (unsigned int) func;
+    as->regs[SP] = top;
+    as->regs[0] = arg0;
+    as->regs[1] = arg1;
+    as->regs[2] = arg2;
+    as->regs[3] = arg3;
+    
+    as->n_flag = 0;
+    as->z_flag = 0;
+    as->c_flag = 0;
+    as->v_flag = 0;
+    
+    memset(&as->vfp, 0, sizeof(as->vfp));
+    as->fpscr = 0;
+    
+    as->computation_count = 0;
+    as->memory_count = 0;
+    as->memory_words = 0;
+    as->branch_taken = 0;
+    as->branch_not_taken = 0;
+    as->fault = FAULT_NONE;
+    
+    if (as->cov_map != NULL) {
+        for (i = 0; i < as->cov_ndirty; i++) {
+            as->cov_map[as->cov_dirty[i]] = 0;
+        }
+    }
+    as->cov_ndirty = 0;
+    as->cov_prev = 0;
+    
+    // recorded calls stay valid across runs, calls in progress don't
+    if (as->memo != NULL) {
+        as->memo->depth = 0;
+        as->memo->called = false;
+    }
+    
+    cache->cache_hit = 0;
+    cache->cache_miss = 0;
+    cache->requests = 0;
+    for (i = 0; i < cache->ndirty; i++) {
+        cache->slots[cache->dirty[i]].v = 0;
+        cache->slots[cache->dirty[i]].tag = 0;
+    }
+    cache->ndirty = 0;
+}
+
+static void set_cpsr_flags(struct arm_state *state, unsigned int a, unsigned int b)
+{
+    unsigned int result = a - b;
+    
+    state->n_flag = result >> 31;
+    
+    state->z_flag = (result == 0);
+    
+    state->c_flag = (a >= b);   // carry is set when the subtraction does not borrow
+    
+    // overflow when the operands' signs differ and the result's sign isn't a's
+    state->v_flag = ((a ^ b) & (a ^ result)) >> 31;
+}
+
+// computes the slot that the address would go in the cache
+static int get_slot(int size, unsigned int addr)
+{
+    return((addr >> 2) & (size -1));
+}
+           
+static unsigned int get_tag(int size, unsigned int addr)
+{
+    int log2 = 0;
+    while(size) {
+        size = size >> 1;
+        log2 = log2 + 1;
+    }
+    return (addr >> (2 + log2)) & ((2 + log2) -1);
+}
+
+static void simulate_cache(struct direct_mapped_cache *cache, unsigned int addr)
+{
+    int addr_slot;
+    unsigned int tag;
+    
+    //update cache requests
+    cache->requests = cache->requests + 1;
+    
+    addr_slot = get_slot(cache->size, addr);
+    tag = get_tag(cache->size, addr);
+    
+    int v = cache->slots[addr_slot].v;
+    int slot_tag = cache->slots[addr_slot].tag;
+        
+    if(v) {
+        if(tag == slot_tag){
+            cache->cache_hit++;
+        } else {
+            cache->cache_miss++;
+            cache->slots[addr_slot].tag = tag;
+            cache->slots[addr_slot].v = 1;
+        }
+    } else {  //v == 0 so update the slot and increment the miss
+        cache->cache_miss++;
+        cache->slots[addr_slot].tag = tag;
+        cache->slots[addr_slot].v = 1;
+        cache->dirty[cache->ndirty++] = addr_slot;
+    }
+}
+
+// records the edge from the previous branch to the instruction at addr
+static void coverage_edge(struct arm_state *state, unsigned int addr)
+{
+    unsigned int cur;
+    unsigned int idx;
+    
+    if (state->cov_map == NULL)
+        return;
+    
+    cur = ((addr >> 2) ^ (addr >> 12)) & (COV_MAP_SIZE - 1);
+    idx = cur ^ state->cov_prev;
+    
+    if (state->cov_map[idx] == 0)
+        state->cov_dirty[state->cov_ndirty++] = idx;
+    if (state->cov_map[idx] != 0xFF)
+        state->cov_map[idx]++;
+    
+    state->cov_prev = cur >> 1;
+}
+
+// returns false and records a fault if a guest access is outside guest memory
+static bool check_address(struct arm_state *state, unsigned int addr, unsigned int len)
+{
+    unsigned int lo;
+    unsigned int hi;
+    
+    if (!state->check_mem)
+        return true;
+    
+    lo = (unsigned int) &state->stack[0];
+    hi = (unsigned int) &state->stack[state->stack_size];
+    if (addr >= lo && addr + len <= hi)
+        return true;
+    if (addr >= state->mem_lo && addr + len <= state->mem_hi)
+        return true;
+    
+    state->fault = FAULT_MEMORY;
+    return false;
+}
+
+// records a store to the stack so arm_state_reset knows how much to clear
+static void stack_store(struct arm_state *state, unsigned int addr)
+{
+    if (addr < state->stack_low && addr >= (unsigned int) state->stack)
+        state->stack_low = addr;
+}
+
+/* Memoization of pure calls. Every call being recorded (a frame) keeps
+   the words it loaded from outside its own frame, which is the stack below
+   sp at the call. A store outside a frame makes that call impure. */
+
+// adds a word to the read set of every frame it is outside of
+static void memo_read(struct arm_state *state, unsigned int addr, unsigned int val)
+{
+    struct memo_cache *mc = state->memo;
+    struct memo_frame *f;
+    bool on_stack;
+    int i;
+    int k;
+    
+    on_stack = addr >= (unsigned int) state->stack && addr < (unsigned int) &state->stack[state->stack_size];
+    for (i = 0; i < mc->depth; i++) {
+        f = &mc->frames[i];
+        if (!f->pure || (on_stack && addr < f->sp))
+            continue;
+        for (k = 0; k < f->nreads && f->read_addr[k] != addr; k++)
+            ;
+        if (k < f->nreads)
+            continue;
+        if (f->nreads == MEMO_READS) {
+            f->pure = false;
+            continue;
+        }
+        f->read_addr[f->nreads] = addr;
+        f->read_val[f->nreads++] = val;
+    }
+}
+
+// called for every guest load and store of len bytes at addr
+static void memo_access(struct arm_state *state, unsigned int addr, unsigned int len, bool store)
+{
+    struct memo_cache *mc = state->memo;
+    unsigned int word;
+    int i;
+    
+    if (mc == NULL || mc->depth == 0)
+        return;
+    
+    if (store) {
+        for (i = 0; i < mc->depth; i++) {
+            if (addr < (unsigned int) state->stack || addr + len > mc->frames[i].sp)
+                mc->frames[i].pure = false;
+        }
+        return;
+    }
+    for (word = addr & ~3; word < addr + len; word += 4) {
+        memo_read(state, word, *((unsigned int *) word));
+    }
+}
+
+// VFP/NEON registers aren't part of a call's key or result
+static void memo_discard(struct arm_state *state)
+{
+    int i;
+    
+    if (state->memo == NULL)
+        return;
+    for (i = 0; i < state->memo->depth; i++) {
+        state->memo->frames[i].pure = false;
+    }
+}
+
+static bool is_data_processing_inst(unsigned int iw)
+{
+    return ((iw >> 26) & 0b11) == 0;
+}
+
+static void armemu_data_processing(struct arm_state *state)
+{
+    unsigned int opcode;
+    unsigned int iw;
+    unsigned int rm_val;
+    unsigned int rd;
+    unsigned int rn;
+    unsigned int i_bit;
+    
+    iw = *((unsigned int *) state->regs[PC]);
+    
+    opcode = (iw >> 21) & 0xF;
+    i_bit = (iw >> 25) & 0b1;
+    
+    rd = (iw >> 12) & 0xF;
+    rn = (iw >> 16) & 0xF;
+    
+    if (i_bit == 1)
+        rm_val = iw & 0xFF;
+    else
+        rm_val = state->regs[(iw & 0xF)];
+    
+    switch(opcode)
+    {
+        case 2: //sub
+            state->regs[rd] = state->regs[rn] - rm_val;
+            break;
+        case 4: //add
+            state->regs[rd] = state->regs[rn] + rm_val;
+            break;
+        case 10: //cmp
+            set_cpsr_flags(state, state->regs[rn], rm_val);
+            break;
+        case 13: //mov
+            state->regs[rd] = rm_val;
+            break;
+    }
+    
+    state->computation_count++;
+    state->regs[PC] = state->regs[PC] + 4;
+}
+
+static bool is_mul_inst(unsigned int iw)
+{
+    unsigned int op;
+    unsigned int op2;
+    
+    op = (iw >> 22) & 0b111111;
+    op2 = (iw >> 4) & 0xF;
+    
+    return (op == 0) && (op2 == 0b1001);
+    
+}
+
+static void armemu_mul(struct arm_state *state)
+{
+    unsigned int iw;
+    unsigned int rd;
+    unsigned int rm;
+    unsigned int rs;
+    
+    iw = *((unsigned int *) state->regs[PC]);
+    
+    rd = (iw >> 16) & 0xF;
+    rm = iw & 0xF;
+    rs = (iw >> 8) & 0xF;
+    
+    state->regs[rd] = state->regs[rm] * state->regs[rs];
+    
+    state->computation_count++;
+    state->regs[PC] = state->regs[PC] + 4;
+}
+
+static bool is_branch_inst(unsigned int iw)
+{
+    unsigned int opcode;
+    // Strictly for checking if bl or b
+    opcode = (iw >> 25) & 0b111 ;
+    
+    return (opcode == 0b101);
+}
+
+static bool condition_flags(struct arm_state *state, unsigned int iw)
+{
+    unsigned int cond = (iw >> 28) & 0xF;
+    
+    switch(cond)
+    {
+        case 0: //beq
+            //takes the branch as the Z flag is set
+            return(state->z_flag == 1);
+            
+        case 1: //bne
+            return(state->z_flag == 0);  //takes the branch
+            
+        case 2: //bcs/bhs
+            return(state->c_flag == 1);
+            
+        case 3: //bcc/blo
+            return(state->c_flag == 0);
+            
+        case 4: //bmi
+            return(state->n_flag == 1);
+            
+        case 5: //bpl
+            return(state->n_flag == 0);
+            
+        case 6: //bvs
+            return(state->v_flag == 1);
+            
+        case 7: //bvc
+            return(state->v_flag == 0);
+            
+        case 8: //bhi
+            //c set and z clear
+            return(state->c_flag == 1 && state->z_flag == 0);
+            
+        case 9: //bls
+            return(state->c_flag == 0 || state->z_flag == 1);
+            
+        case 10: //bge
+            //n equals v
+            return(state->n_flag == state->v_flag);
+            
+        case 11: //blt
+            //n not equal to v
+            return (state->n_flag != state->v_flag);
+            
+        case 12: //bgt
+            //z clear and n equals v
+            return(state->z_flag == 0 && (state->n_flag == state-> v_flag));
+            
+        case 13: //ble
+            return(state->z_flag == 1 || (state->n_flag != state->v_flag));
+            
+        case 14: //always
+            return true;
+    }
+    return false;
+}
+
+/* Hot loops: a backward branch taken LOOP_HOT times records one iteration
+   of the loop body as a trace of predecoded operations. Later entries run
+   the trace instead of decoding each instruction, with every conditional
+   branch turned into a guard on the direction it took while recording. */
+static void loop_backedge(struct arm_state *state)
+{
+    struct loop_cache *lc = state->loops;
+    struct loop_trace *t;
+    unsigned int head = state->regs[PC];
+    
+    if (lc->recording != NULL)
+        return;
+    
+    t = &lc->loops[(head >> 2) % LOOP_SLOTS];
+    if (t->head != head) {
+        t->head = head;
+        t->count = 0;
+        t->compiled = false;
+        t->failed = false;
+    }
+    if (t->failed)
+        return;
+    
+    if (t->compiled) {
+        lc->pending = t;
+    } else if (++t->count == LOOP_HOT) {
+        t->n = 0;
+        t->entries = 0;
+        t->iterations = 0;
+        lc->recording = t;
+    }
+}
+
+// branch or branch and link w/ bne / beq
+static void armemu_branch(struct arm_state *state)
+{
+    unsigned int iw;
+    unsigned int link;
+    int offset;
+    int significant_bit;
+    int byte_address;
+    int mask = 0xFF000000; //32 bit's of 1s
+
+    iw = *((unsigned int *) state->regs[PC]);
+    
+    link = (iw >> 24) & 0b1;
+    offset = iw & 0xFFFFFF;
+    significant_bit = (iw >> 23) & 0b1;
+    
+    if(condition_flags(state, iw)){
+        state->branch_taken += 1;
+        
+        if(significant_bit)
+        {
+            //adjust offset to be a 2's comp byte address by sign extending the offset
+             offset = offset | mask;
+             offset = (~ offset) + 1;
+             offset = offset * -1;
+        }
+        //add new offset to PC
+        byte_address = offset * 4;
+        int adjust = byte_address + 8;
+        
+        if(link)   //branch with link
+            state->regs[LR] = state->regs[PC] + 4;     //set LR to PC + 4 (the next instruction)
+            state->regs[PC] = state->regs[PC] + adjust;
+        
+        if (state->memo != NULL && link)
+            state->memo->called = true;
+        
+        if (state->loops != NULL && adjust < 0 && !link)
+            loop_backedge(state);
+    }
+    else {
+        state->branch_not_taken++;
+        state->regs[PC] += 4;
+    }
+    coverage_edge(state, state->regs[PC]);
+}
+
+static bool is_bx_inst(unsigned int iw)
+{
+    unsigned int bx_code;
+    
+    bx_code = (iw >> 4) & 0x00FFFFFF;
+    
+    return (bx_code == 0b000100101111111111110001);
+}
+
+static void armemu_bx(struct arm_state *state)
+{
+    unsigned int iw;
+    unsigned int rn;
+    
+    iw = *((unsigned int *) state->regs[PC]);
+    rn = iw & 0b1111;
+    
+    state->branch_taken++;
+    state->regs[PC] = state->regs[rn];
+    coverage_edge(state, state->regs[PC]);
+}
+
+static bool is_single_data_transfer_inst(unsigned int iw)
+{
+    unsigned int op;
+    
+    op = (iw >> 26) & 0b11;
+    
+    return op == 0b01;
+}
+
+static void armemu_single_data_transfer(struct arm_state *state)
+{
+    unsigned int iw;
+    unsigned int rd;
+    unsigned int rn;
+    unsigned int offset;
+    unsigned int base;
+    unsigned int i_bit;
+    unsigned int p_bit;
+    unsigned int u_bit;
+    unsigned int b_bit;
+    unsigned int w_bit;
+    unsigned int l_bit;
+    unsigned int offset_address;
+    unsigned int target_address;
+    unsigned int val;
+    
+    iw = *((unsigned int *) state->regs[PC]);
+    
+    rd = (iw >> 12) & 0xF;
+    rn = (iw >> 16) & 0xF;
+    
+    i_bit = (iw >> 25) & 0b1;
+    p_bit = (iw >> 24) & 0b1;
+    u_bit = (iw >> 23) & 0b1;
+    b_bit = (iw >> 22) & 0b1;
+    w_bit = (iw >> 21) & 0b1;
+    l_bit = (iw >> 20) & 0b1;
+    
+    //Check i bit
+    if (i_bit == 1)
+        offset = state->regs[(iw & 0xF)];
+    else
+        offset = iw & 0xFFF;
+    
+    base = state->regs[rn];
+    if (rn == PC)
+        base = base + 8;
+    
+    //Check u bit, then p bit for pre or post indexing
+    offset_address = u_bit ? base + offset : base - offset;
+    target_address = p_bit ? offset_address : base;
+    
+    if (!check_address(state, target_address, b_bit ? 1 : 4))
+        return;
+    memo_access(state, target_address, b_bit ? 1 : 4, !l_bit);
+    
+    //Post indexing and w bit write the address back (push/pop of one register)
+    if (!p_bit || w_bit)
+        state->regs[rn] = offset_address;
+    
+    //Check b bit
+    if (b_bit == 1) {
+    // Check l bit
+        if (l_bit == 1) {
+            state->regs[rd] = (unsigned int)*((unsigned char *)target_address); //ldrb
+        }
+        else {
+            *((unsigned char *) target_address) = state->regs[rd]; //strb
+            stack_store(state, target_address);
+        }
+    }
+    else {
+    //Check l bit
+        if (l_bit == 1) {
+            val = *((unsigned int *) target_address); //ldr
+            if (rd == PC) {
+                state->memory_count++;
+                state->memory_words++;
+                state->regs[PC] = val & ~1;
+                coverage_edge(state, state->regs[PC]);
+                return;
+            }
+            state->regs[rd] = val;
+        }
+        else {
+            *((unsigned int *) target_address) = state->regs[rd]; //str
+            stack_store(state, target_address);
+        }
+    }
+    state->memory_count++;
+    state->memory_words++;
+    state->regs[PC] = state->regs[PC] + 4;
+}
+
+static bool is_block_data_transfer_inst(unsigned int iw)
+{
+    unsigned int op;
+    
+    op = (iw >> 25) & 0b111;
+    
+    return op == 0b100;
+}
+
+/* ldm/stm, including push (stmdb sp!) and pop (ldmia sp!). The register
+   list is moved with one bounds check: registers go to ascending addresses
+   in ascending order, so a contiguous list is a single memcpy. */
+static void armemu_block_data_transfer(struct arm_state *state)
+{
+    unsigned int iw;
+    unsigned int rn;
+    unsigned int list;
+    unsigned int p_bit;
+    unsigned int u_bit;
+    unsigned int w_bit;
+    unsigned int l_bit;
+    unsigned int n;
+    unsigned int first;
+    unsigned int base;
+    unsigned int start_address;
+    unsigned int *mem;
+    unsigned int i;
+    unsigned int k;
+    
+    iw = *((unsigned int *) state->regs[PC]);
+    
+    rn = (iw >> 16) & 0xF;
+    list = iw & 0xFFFF;
+    p_bit = (iw >> 24) & 0b1;
+    u_bit = (iw >> 23) & 0b1;
+    w_bit = (iw >> 21) & 0b1;
+    l_bit = (iw >> 20) & 0b1;
+    
+    if (list == 0 || ((iw >> 22) & 0b1)) { //empty list, user mode registers
+        state->fault = FAULT_UNDEFINED;
+        return;
+    }
+    
+    if (!condition_flags(state, iw)) {
+        state->memory_count++;
+        state->regs[PC] = state->regs[PC] + 4;
+        return;
+    }
+    
+    n = __builtin_popcount(list);
+    first = __builtin_ctz(list);
+    base = state->regs[rn];
+    
+    //ia, ib, da, db
+    if (u_bit)
+        start_address = p_bit ? base + 4 : base;
+    else
+        start_address = p_bit ? base - 4 * n : base - 4 * n + 4;
+    
+    if (!check_address(state, start_address, 4 * n))
+        return;
+    memo_access(state, start_address, 4 * n, !l_bit);
+    mem = (unsigned int *) start_address;
+    
+    if (l_bit) {
+        if (w_bit)
+            state->regs[rn] = u_bit ? base + 4 * n : base - 4 * n;
+        if ((list >> first) == (1 << n) - 1 && !(list & (1 << PC))) {
+            memcpy(&state->regs[first], mem, 4 * n);
+        } else {
+            for (i = 0, k = 0; i < NREGS; i++) {
+                if (list & (1 << i))
+                    state->regs[i] = mem[k++];
+            }
+        }
+    } else {
+        if ((list >> first) == (1 << n) - 1 && !(list & (1 << PC))) {
+            memcpy(mem, &state->regs[first], 4 * n);
+        } else {
+            for (i = 0, k = 0; i < NREGS; i++) {
+                if (list & (1 << i))
+                    mem[k++] = (i == PC) ? state->regs[PC] + 8 : state->regs[i];
+            }
+        }
+        stack_store(state, start_address);
+        if (w_bit)
+            state->regs[rn] = u_bit ? base + 4 * n : base - 4 * n;
+    }
+    
+    state->memory_count++;
+    state->memory_words += n;
+    
+    //pop {..., pc} returns, the PC was overwritten by the load
+    if (l_bit && (list & (1 << PC))) {
+        state->regs[PC] = state->regs[PC] & ~1;
+        coverage_edge(state, state->regs[PC]);
+    } else {
+        state->regs[PC] = state->regs[PC] + 4;
+    }
+}
+
+/* VFP: cp10/cp11 coprocessor instructions, and the Advanced SIMD
+   transfers (vdup, vmov scalar) that share their encoding space */
+static bool is_vfp_inst(unsigned int iw)
+{
+    unsigned int cond;
+    unsigned int op;
+    unsigned int coproc;
+    
+    cond = (iw >> 28) & 0xF;
+    op = (iw >> 24) & 0xF;
+    coproc = (iw >> 9) & 0b111;
+    
+    return (cond != 0xF) && ((op >> 2) == 0b11) && (op != 0xF) && (coproc == 0b101);
+}
+
+// single precision registers are Vd:D, double precision registers are D:Vd
+static unsigned int vfp_reg(unsigned int iw, int dbl, int v_shift, int bit)
+{
+    unsigned int v = (iw >> v_shift) & 0xF;
+    unsigned int b = (iw >> bit) & 0b1;
+    
+    if (dbl)
+        return (b << 4) | v;
+    return (v << 1) | b;
+}
+
+// reads Dn (q == 0, upper half zero) or Qn/2 (q == 1)
+static void neon_read(struct arm_state *state, unsigned int reg, int q, union neon_reg *r)
+{
+    if (q) {
+        r->w = *((v4u32 *) &state->vfp.d[reg & ~1]);
+    } else {
+        r->w = (v4u32) {0, 0, 0, 0};
+        r->q[0] = state->vfp.d[reg];
+    }
+}
+
+static void neon_write(struct arm_state *state, unsigned int reg, int q, union neon_reg *r)
+{
+    if (q)
+        *((v4u32 *) &state->vfp.d[reg & ~1]) = r->w;
+    else
+        state->vfp.d[reg] = r->q[0];
+}
+
+// converts to a 32 bit integer the way vcvt does, saturating on overflow
+static unsigned int vfp_to_int(double x, bool is_signed, bool round_zero)
+{
+    if (x != x)
+        return 0;
+    if (!round_zero)
+        x = nearbyint(x);
+    if (is_signed) {
+        if (x >= 2147483647.0)
+            return 0x7FFFFFFF;
+        if (x <= -2147483648.0)
+            return 0x80000000;
+        return (unsigned int) (int) x;
+    }
+    if (x >= 4294967295.0)
+        return 0xFFFFFFFF;
+    if (x <= 0)
+        return 0;
+    return (unsigned int) x;
+}
+
+static void armemu_vfp_data_processing(struct arm_state *state, unsigned int iw)
+{
+    unsigned int opc1;
+    unsigned int opc2;
+    unsigned int op;
+    unsigned int e_bit;
+    unsigned int vd;
+    unsigned int vn;
+    unsigned int vm;
+    unsigned int nzcv;
+    int dbl;
+    double a;
+    double b;
+    double c;
+    double r;
+    
+    opc1 = ((iw >> 21) & 0b100) | ((iw >> 20) & 0b11);
+    opc2 = (iw >> 16) & 0xF;
+    op = (iw >> 6) & 0b1;
+    e_bit = (iw >> 7) & 0b1;
+    dbl = (iw >> 8) & 0b1;
+    
+    vd = vfp_reg(iw, dbl, 12, 22);
+    vn = vfp_reg(iw, dbl, 16, 7);
+    vm = vfp_reg(iw, dbl, 0, 5);
+    
+    // single precision is computed in double and rounded after every
+    // operation, which gives the correctly rounded single precision result
+    a = dbl ? state->vfp.df[vn] : state->vfp.f[vn];
+    b = dbl ? state->vfp.df[vm] : state->vfp.f[vm];
+    c = dbl ? state->vfp.df[vd] : state->vfp.f[vd];
+    
+    switch(opc1)
+    {
+        case 0b000: //vmla, vmls
+            r = dbl ? a * b : (float) (a * b);
+            r = op ? c - r : c + r;
+            break;
+        case 0b010: //vmul, vnmul
+            r = op ? -(a * b) : a * b;
+            break;
+        case 0b011: //vadd, vsub
+            r = op ? a - b : a + b;
+            break;
+        case 0b100: //vdiv
+            if (op) {
+                state->fault = FAULT_UNDEFINED;
+                return;
+            }
+            r = a / b;
+            break;
+        case 0b111:
+            if (op == 0) { //vmov immediate
+                state->fault = FAULT_UNDEFINED;
+                return;
+            }
+            switch(opc2)
+            {
+                case 0b0000: //vmov, vabs
+                    r = e_bit ? fabs(b) : b;
+                    break;
+                case 0b0001: //vneg, vsqrt
+                    r = e_bit ? sqrt(b) : -b;
+                    break;
+                case 0b0100: //vcmp
+                case 0b0101: //vcmp with zero
+                    if (opc2 == 0b0101)
+                        b = 0;
+                    if (c != c || b != b)
+                        nzcv = 0b0011;
+                    else if (c == b)
+                        nzcv = 0b0110;
+                    else if (c < b)
+                        nzcv = 0b1000;
+                    else
+                        nzcv = 0b0010;
+                    state->fpscr = (state->fpscr & 0x0FFFFFFF) | (nzcv << 28);
+                    state->computation_count++;
+                    state->regs[PC] = state->regs[PC] + 4;
+                    return;
+                case 0b0111: //vcvt between single and double
+                    vd = vfp_reg(iw, !dbl, 12, 22);
+                    b = dbl ? state->vfp.df[vm] : state->vfp.f[vm];
+                    if (dbl)
+                        state->vfp.f[vd] = (float) b;
+                    else
+                        state->vfp.df[vd] = b;
+                    state->computation_count++;
+                    state->regs[PC] = state->regs[PC] + 4;
+                    return;
+                case 0b1000: //vcvt from integer, the source is always a single register
+                    vm = vfp_reg(iw, 0, 0, 5);
+                    r = e_bit ? (double) (int) state->vfp.s[vm] : (double) state->vfp.s[vm];
+                    break;
+                case 0b1100: //vcvt to integer, the destination is always a single register
+                case 0b1101:
+                    vd = vfp_reg(iw, 0, 12, 22);
+                    state->vfp.s[vd] = vfp_to_int(b, opc2 & 0b1, e_bit);
+                    state->computation_count++;
+                    state->regs[PC] = state->regs[PC] + 4;
+                    return;
+                default:
+                    state->fault = FAULT_UNDEFINED;
+                    return;
+            }
+            break;
+        default:
+            state->fault = FAULT_UNDEFINED;
+            return;
+    }
+    
+    if (dbl)
+        state->vfp.df[vd] = r;
+    else
+        state->vfp.f[vd] = (float) r;
+    
+    state->computation_count++;
+    state->regs[PC] = state->regs[PC] + 4;
+}
+
+// vldr, vstr, vldm, vstm (vpush and vpop are vstmdb and vldmia on sp)
+static void armemu_vfp_load_store(struct arm_state *state, unsigned int iw)
+{
+    unsigned int p_bit;
+    unsigned int u_bit;
+    unsigned int w_bit;
+    unsigned int l_bit;
+    unsigned int rn;
+    unsigned int vd;
+    unsigned int imm;
+    unsigned int base;
+    unsigned int target_address;
+    unsigned int len;
+    int dbl;
+    
+    p_bit = (iw >> 24) & 0b1;
+    u_bit = (iw >> 23) & 0b1;
+    w_bit = (iw >> 21) & 0b1;
+    l_bit = (iw >> 20) & 0b1;
+    rn = (iw >> 16) & 0xF;
+    dbl = (iw >> 8) & 0b1;
+    imm = (iw & 0xFF) * 4;
+    vd = vfp_reg(iw, dbl, 12, 22);
+    
+    // there is no decrement after form, and 1100 0x00 isn't a transfer at all
+    if (!p_bit && !u_bit) {
+        state->fault = FAULT_UNDEFINED;
+        return;
+    }
+    
+    base = state->regs[rn];
+    if (rn == PC)
+        base = (base + 8) & ~3;
+    
+    if (p_bit && !w_bit) { //vldr, vstr
+        target_address = u_bit ? base + imm : base - imm;
+        len = dbl ? 8 : 4;
+    } else { //vldm, vstm
+        target_address = p_bit ? base - imm : base;
+        len = imm;
+        if (w_bit)
+            state->regs[rn] = u_bit ? base + imm : base - imm;
+    }
+    
+    if ((dbl ? vd * 8 : vd * 4) + len > (dbl ? 256 : 128)) {
+        state->fault = FAULT_UNDEFINED;
+        return;
+    }
+    if (!check_address(state, target_address, len))
+        return;
+    memo_access(state, target_address, len, !l_bit);
+    
+    if (l_bit) {
+        memcpy(dbl ? (void *) &state->vfp.d[vd] : (void *) &state->vfp.s[vd], (void *) target_address, len);
+    } else {
+        memcpy((void *) target_address, dbl ? (void *) &state->vfp.d[vd] : (void *) &state->vfp.s[vd], len);
+        stack_store(state, target_address);
+    }
+    
+    state->memory_count++;
+    state->memory_words += len / 4;
+    state->regs[PC] = state->regs[PC] + 4;
+}
+
+// vmov between core and VFP registers, vmrs/vmsr, vdup and vmov scalar
+static void armemu_vfp_move(struct arm_state *state, unsigned int iw)
+{
+    unsigned int rt;
+    unsigned int rt2;
+    unsigned int vn;
+    unsigned int index;
+    unsigned int val;
+    unsigned int size;
+    union neon_reg r;
+    
+    rt = (iw >> 12) & 0xF;
+    
+    if ((iw & 0x0FFF0FFF) == 0x0EF10A10) { //vmrs
+        if (rt == PC) {
+            state->n_flag = (state->fpscr >> 31) & 0b1;
+            state->z_flag = (state->fpscr >> 30) & 0b1;
+            state->c_flag = (state->fpscr >> 29) & 0b1;
+            state->v_flag = (state->fpscr >> 28) & 0b1;
+        } else {
+            state->regs[rt] = state->fpscr;
+        }
+    } else if ((iw & 0x0FFF0FFF) == 0x0EE10A10) { //vmsr
+        state->fpscr = state->regs[rt];
+    } else if ((iw & 0x0FE00F7F) == 0x0E000A10) { //vmov between a core and a single register
+        vn = vfp_reg(iw, 0, 16, 7);
+        if ((iw >> 20) & 0b1)
+            state->regs[rt] = state->vfp.s[vn];
+        else
+            state->vfp.s[vn] = state->regs[rt];
+    } else if ((iw & 0x0FE00ED0) == 0x0C400A10) { //vmov between two core registers and two singles or a double
+        rt2 = (iw >> 16) & 0xF;
+        if ((iw >> 8) & 0b1)
+            vn = vfp_reg(iw, 1, 0, 5) * 2;
+        else
+            vn = vfp_reg(iw, 0, 0, 5);
+        if (vn == 31 || rt == PC || rt2 == PC || (((iw >> 20) & 0b1) && rt == rt2)) {
+            state->fault = FAULT_UNDEFINED;
+            return;
+        }
+        if ((iw >> 20) & 0b1) {
+            state->regs[rt] = state->vfp.s[vn];
+            state->regs[rt2] = state->vfp.s[vn + 1];
+        } else {
+            state->vfp.s[vn] = state->regs[rt];
+            state->vfp.s[vn + 1] = state->regs[rt2];
+        }
+    } else if ((iw & 0x0FD00F7F) == 0x0E100B10) { //vmov.32 rt, dn[x]
+        vn = vfp_reg(iw, 1, 16, 7);
+        index = (iw >> 21) & 0b1;
+        state->regs[rt] = state->vfp.s[vn * 2 + index];
+    } else if ((iw & 0x0FD00F7F) == 0x0E000B10) { //vmov.32 dn[x], rt
+        vn = vfp_reg(iw, 1, 16, 7);
+        index = (iw >> 21) & 0b1;
+        state->vfp.s[vn * 2 + index] = state->regs[rt];
+    } else if ((iw & 0x0F900F5F) == 0x0E800B10) { //vdup from a core register
+        vn = vfp_reg(iw, 1, 16, 7);
+        size = (((iw >> 22) & 0b1) << 1) | ((iw >> 5) & 0b1);
+        val = state->regs[rt];
+        if (size == 0b10)
+            val = (val & 0xFF) * 0x01010101;
+        else if (size == 0b01)
+            val = (val & 0xFFFF) * 0x00010001;
+        else if (size != 0b00) {
+            state->fault = FAULT_UNDEFINED;
+            return;
+        }
+        r.w = (v4u32) {val, val, val, val};
+        neon_write(state, vn, (iw >> 21) & 0b1, &r);
+    } else {
+        state->fault = FAULT_UNDEFINED;
+        return;
+    }
+    
+    state->computation_count++;
+    state->regs[PC] = state->regs[PC] + 4;
+}
+
+static void armemu_vfp(struct arm_state *state)
+{
+    unsigned int iw;
+    
+    memo_discard(state);
+    iw = *((unsigned int *) state->regs[PC]);
+    
+    if (!condition_flags(state, iw)) {
+        state->computation_count++;
+        state->regs[PC] = state->regs[PC] + 4;
+        return;
+    }
+    
+    // 1100 010x moves two core registers, the rest of 110x is loads and stores
+    if (((iw >> 21) & 0x7F) == 0b1100010)
+        armemu_vfp_move(state, iw);
+    else if (((iw >> 25) & 0b111) == 0b110)
+        armemu_vfp_load_store(state, iw);
+    else if (((iw >> 4) & 0b1) == 0)
+        armemu_vfp_data_processing(state, iw);
+    else
+        armemu_vfp_move(state, iw);
+}
+
+/* Advanced SIMD (NEON): data processing (1111 001x) and element or
+   structure loads/stores (1111 0100 xxx0). Q and D registers are moved
+   through host vector types so a 128 bit guest operation is one host
+   vector operation. */
+static bool is_neon_inst(unsigned int iw)
+{
+    return ((iw >> 25) == 0b1111001) || (((iw >> 24) == 0xF4) && (((iw >> 20) & 0b1) == 0));
+}
+
+// vadd, vsub, vmul, vmla, vmls (integer and f32) and the bitwise ops
+static void armemu_neon_data_processing(struct arm_state *state, unsigned int iw)
+{
+    unsigned int u_bit;
+    unsigned int size;
+    unsigned int opc;
+    unsigned int o1;
+    unsigned int vd;
+    unsigned int vn;
+    unsigned int vm;
+    int q;
+    union neon_reg n;
+    union neon_reg m;
+    union neon_reg d;
+    union neon_reg p;
+    
+    // only the "three registers of the same length" group
+    if ((iw >> 23) & 0b1) {
+        state->fault = FAULT_UNDEFINED;
+        return;
+    }
+    
+    u_bit = (iw >> 24) & 0b1;
+    size = (iw >> 20) & 0b11;
+    opc = (iw >> 8) & 0xF;
+    o1 = (iw >> 4) & 0b1;
+    q = (iw >> 6) & 0b1;
+    
+    vd = vfp_reg(iw, 1, 12, 22);
+    vn = vfp_reg(iw, 1, 16, 7);
+    vm = vfp_reg(iw, 1, 0, 5);
+    
+    neon_read(state, vn, q, &n);
+    neon_read(state, vm, q, &m);
+    neon_read(state, vd, q, &d);
+    
+    if (opc == 0b0001 && o1) { //vand, vbic, vorr, vorn, veor, vbsl
+        switch((u_bit << 2) | size)
+        {
+            case 0b000: d.w = n.w & m.w; break;
+            case 0b001: d.w = n.w & ~m.w; break;
+            case 0b010: d.w = n.w | m.w; break;
+            case 0b011: d.w = n.w | ~m.w; break;
+            case 0b100: d.w = n.w ^ m.w; break;
+            case 0b101: d.w = (d.w & n.w) | (~d.w & m.w); break;
+            default:
+                state->fault = FAULT_UNDEFINED;
+                return;
+        }
+    } else if ((opc == 0b1000 && !o1) || (opc == 0b1001 && !o1) || (opc == 0b1001 && o1 && !u_bit)) {
+        if (size == 0b11 && opc == 0b1001) {
+            state->fault = FAULT_UNDEFINED;
+            return;
+        }
+        // vmul, vmla and vmls work on the lane products
+        if (opc == 0b1001) {
+            switch(size)
+            {
+                case 0: p.b = n.b * m.b; break;
+                case 1: p.h = n.h * m.h; break;
+                case 2: p.w = n.w * m.w; break;
+            }
+            n = d;
+            m = p;
+            if (o1)
+                n.w = (v4u32) {0, 0, 0, 0};
+        }
+        // vsub and vmls subtract, vadd, vmla and vmul add
+        if (u_bit) {
+            switch(size)
+            {
+                case 0: d.b = n.b - m.b; break;
+                case 1: d.h = n.h - m.h; break;
+                case 2: d.w = n.w - m.w; break;
+                case 3: d.q = n.q - m.q; break;
+            }
+        } else {
+            switch(size)
+            {
+                case 0: d.b = n.b + m.b; break;
+                case 1: d.h = n.h + m.h; break;
+                case 2: d.w = n.w + m.w; break;
+                case 3: d.q = n.q + m.q; break;
+            }
+        }
+    } else if (opc == 0b1101 && (size & 0b1) == 0) {
+        if (!o1 && !u_bit) { //vadd.f32, vsub.f32
+            d.f = (size & 0b10) ? n.f - m.f : n.f + m.f;
+        } else if (o1 && !u_bit) { //vmla.f32, vmls.f32
+            p.f = n.f * m.f;
+            d.f = (size & 0b10) ? d.f - p.f : d.f + p.f;
+        } else if (o1 && u_bit && !(size & 0b10)) { //vmul.f32
+            d.f = n.f * m.f;
+        } else {
+            state->fault = FAULT_UNDEFINED;
+            return;
+        }
+    } else {
+        state->fault = FAULT_UNDEFINED;
+        return;
+    }
+    
+    neon_write(state, vd, q, &d);
+    
+    state->computation_count++;
+    state->regs[PC] = state->regs[PC] + 4;
+}
+
+// vld1, vst1 of one to four consecutive D registers
+static void armemu_neon_load_store(struct arm_state *state, unsigned int iw)
+{
+    unsigned int type;
+    unsigned int l_bit;
+    unsigned int rn;
+    unsigned int rm;
+    unsigned int vd;
+    unsigned int nregs;
+    unsigned int target_address;
+    
+    type = (iw >> 8) & 0xF;
+    l_bit = (iw >> 21) & 0b1;
+    rn = (iw >> 16) & 0xF;
+    rm = iw & 0xF;
+    vd = vfp_reg(iw, 1, 12, 22);
+    
+    switch(type)
+    {
+        case 0b0111: nregs = 1; break;
+        case 0b1010: nregs = 2; break;
+        case 0b0110: nregs = 3; break;
+        case 0b0010: nregs = 4; break;
+        default: //vld2-4 and the single element forms
+            state->fault = FAULT_UNDEFINED;
+            return;
+    }
+    if ((((iw >> 23) & 0b1) == 1) || (vd + nregs > 32)) {
+        state->fault = FAULT_UNDEFINED;
+        return;
+    }
+    
+    target_address = state->regs[rn];
+    if (!check_address(state, target_address, nregs * 8))
+        return;
+    memo_access(state, target_address, nregs * 8, !l_bit);
+    
+    // lanes are little endian in both guest memory and the register file
+    if (l_bit) {
+        memcpy(&state->vfp.d[vd], (void *) target_address, nregs * 8);
+    } else {
+        memcpy((void *) target_address, &state->vfp.d[vd], nregs * 8);
+        stack_store(state, target_address);
+    }
+    
+    if (rm == SP)
+        state->regs[rn] = target_address + nregs * 8;
+    else if (rm != PC)
+        state->regs[rn] = target_address + state->regs[rm];
+    
+    state->memory_count++;
+    state->memory_words += nregs * 2;
+    state->regs[PC] = state->regs[PC] + 4;
+}
+
+static void armemu_neon(struct arm_state *state)
+{
+    unsigned int iw;
+    
+    memo_discard(state);
+    iw = *((unsigned int *) state->regs[PC]);
+    
+    if ((iw >> 24) == 0xF4)
+        armemu_neon_load_store(state, iw);
+    else
+        armemu_neon_data_processing(state, iw);
+}
+
+/* Instruction classes, armemu_one checks them in this order */
+int classify_inst(unsigned int iw)
+{
+    if (is_neon_inst(iw))
+        return INST_NEON;
+    if (is_vfp_inst(iw))
+        return INST_VFP;
+    if (is_bx_inst(iw))
+        return INST_BX;
+    if (is_branch_inst(iw))
+        return INST_BRANCH;
+    if (is_mul_inst(iw))
+        return INST_MUL;
+    if (is_data_processing_inst(iw))
+        return INST_DATA_PROCESSING;
+    if (is_single_data_transfer_inst(iw))
+        return INST_SINGLE_DATA_TRANSFER;
+    if (is_block_data_transfer_inst(iw))
+        return INST_BLOCK_DATA_TRANSFER;
+    return INST_UNDEFINED;
+}
+
+// true if the instruction ends a basic block: branches and loads into the pc
+static bool is_block_end(int kind, unsigned int iw)
+{
+    if (kind == INST_BX || kind == INST_BRANCH)
+        return true;
+    if (kind == INST_SINGLE_DATA_TRANSFER)
+        return ((iw >> 20) & 0b1) && ((iw >> 12) & 0xF) == PC;
+    if (kind == INST_BLOCK_DATA_TRANSFER)
+        return ((iw >> 20) & 0b1) && ((iw >> PC) & 0b1);
+    return false;
+}
+
+// decodes one word at a time with the predicates armemu_one uses
+int decode_words_scalar(unsigned int *words, int n, struct decoded_words *out)
+{
+    unsigned int iw;
+    int kind;
+    int blocks = 0;
+    int i;
+    
+    for (i = 0; i < n; i++) {
+        iw = words[i];
+        kind = classify_inst(iw);
+        out->kind[i] = kind;
+        out->rd[i] = (kind == INST_MUL) ? (iw >> 16) & 0xF : (iw >> 12) & 0xF;
+        out->rn[i] = (kind == INST_MUL) ? (iw >> 8) & 0xF : (iw >> 16) & 0xF;
+        out->rm[i] = iw & 0xF;
+        out->end[i] = is_block_end(kind, iw);
+        blocks += out->end[i];
+    }
+    return blocks;
+}
+
+/* Decodes DECODE_LANES words at a time. Every class predicate is evaluated
+   for all lanes with vector compares, the class is picked by masking in
+   reverse precedence order, and the fields are narrowed to bytes with
+   vector conversions. Block ends come out of the same pass. Returns the
+   number of block ends in the n words (n <= DECODE_MAX). */
+int decode_words(unsigned int *words, int n, struct decoded_words *out)
+{
+    vdecode w;
+    vdecode kind;
+    vdecode m;
+    vdecode load;
+    vdecode end;
+    vdecode rd;
+    vdecode rn;
+    vdecode ends = {0};
+    int blocks = 0;
+    int i;
+    int j;
+    
+    for (i = 0; i + DECODE_LANES <= n; i += DECODE_LANES) {
+        memcpy(&w, &words[i], sizeof(w));
+        
+        kind = (vdecode) {0};
+        m = (((w >> 25) & 0b111) == 0b100);
+        kind = (m & INST_BLOCK_DATA_TRANSFER) | (~m & kind);
+        m = (((w >> 26) & 0b11) == 0b01);
+        kind = (m & INST_SINGLE_DATA_TRANSFER) | (~m & kind);
+        m = (((w >> 26) & 0b11) == 0);
+        kind = (m & INST_DATA_PROCESSING) | (~m & kind);
+        m = (((w >> 22) & 0b111111) == 0) & (((w >> 4) & 0xF) == 0b1001);
+        kind = (m & INST_MUL) | (~m & kind);
+        m = (((w >> 25) & 0b111) == 0b101);
+        kind = (m & INST_BRANCH) | (~m & kind);
+        m = (((w >> 4) & 0x00FFFFFF) == 0b000100101111111111110001);
+        kind = (m & INST_BX) | (~m & kind);
+        m = ((w >> 28) != 0xF) & (((w >> 26) & 0b11) == 0b11) & (((w >> 24) & 0xF) != 0xF) & (((w >> 9) & 0b111) == 0b101);
+        kind = (m & INST_VFP) | (~m & kind);
+        m = ((w >> 25) == 0b1111001) | (((w >> 24) == 0xF4) & (((w >> 20) & 0b1) == 0));
+        kind = (m & INST_NEON) | (~m & kind);
+        
+        // the register fields move for mul
+        m = (kind == INST_MUL);
+        rd = (m & (w >> 16)) | (~m & (w >> 12));
+        rn = (m & (w >> 8)) | (~m & (w >> 16));
+        
+        load = ((w >> 20) & 0b1) == 1;
+        end = (kind == INST_BX) | (kind == INST_BRANCH)
+            | ((kind == INST_SINGLE_DATA_TRANSFER) & load & (((w >> 12) & 0xF) == PC))
+            | ((kind == INST_BLOCK_DATA_TRANSFER) & load & (((w >> PC) & 0b1) == 1));
+        end = end & 1;
+        ends += end;
+        
+        *((vdecode8 *) &out->kind[i]) = __builtin_convertvector(kind, vdecode8);
+        *((vdecode8 *) &out->rd[i]) = __builtin_convertvector(rd & 0xF, vdecode8);
+        *((vdecode8 *) &out->rn[i]) = __builtin_convertvector(rn & 0xF, vdecode8);
+        *((vdecode8 *) &out->rm[i]) = __builtin_convertvector(w & 0xF, vdecode8);
+        *((vdecode8 *) &out->end[i]) = __builtin_convertvector(end, vdecode8);
+    }
+    for (j = 0; j < DECODE_LANES; j++) {
+        blocks += ends[j];
+    }
+    
+    // the tail that doesn't fill a vector
+    if (i < n) {
+        struct decoded_words tail;
+        int rest = n - i;
+        blocks += decode_words_scalar(&words[i], rest, &tail);
+        memcpy(&out->kind[i], tail.kind, rest);
+        memcpy(&out->rd[i], tail.rd, rest);
+        memcpy(&out->rn[i], tail.rn, rest);
+        memcpy(&out->rm[i], tail.rm, rest);
+        memcpy(&out->end[i], tail.end, rest);
+    }
+    return blocks;
+}
+
+// the class of the instruction at pc, decoding its whole region on first touch
+static int decode_kind(struct decode_cache *dc, unsigned int pc)
+{
+    struct decoded_words words;
+    struct decode_region *r;
+    unsigned int base;
+    
+    // an aligned region never crosses a page, so it is mapped if pc is
+    base = pc & ~(DECODE_MAX * 4 - 1);
+    r = &dc->regions[(base / (DECODE_MAX * 4)) % DECODE_REGIONS];
+    if (r->base != base) {
+        decode_words((unsigned int *) base, DECODE_MAX, &words);
+        memcpy(r->kind, words.kind, DECODE_MAX);
+        r->base = base;
+        dc->decoded++;
+    }
+    return r->kind[(pc - base) / 4];
+}
+
+static void armemu_one(struct arm_state *state, struct direct_mapped_cache *cache)
+{
+    unsigned int iw;
+    iw = *((unsigned int *) state->regs[PC]);
+    simulate_cache(cache, state->regs[PC]);
+    
+    switch(state->decode != NULL ? decode_kind(state->decode, state->regs[PC]) : classify_inst(iw))
+    {
+        case INST_NEON:
+            armemu_neon(state);
+            break;
+        case INST_VFP:
+            armemu_vfp(state);
+            break;
+        case INST_BX:
+            armemu_bx(state);
+            break;
+        case INST_BRANCH:
+            armemu_branch(state);
+            break;
+        case INST_MUL:
+            armemu_mul(state);
+            break;
+        case INST_DATA_PROCESSING:
+            armemu_data_processing(state);
+            break;
+        case INST_SINGLE_DATA_TRANSFER:
+            armemu_single_data_transfer(state);
+            break;
+        case INST_BLOCK_DATA_TRANSFER:
+            armemu_block_data_transfer(state);
+            break;
+        default:
+            state->fault = FAULT_UNDEFINED;
+    }
+}
+
+unsigned int instruction_total(struct arm_state *state)
+{
+    return state->computation_count + state->memory_count + state->branch_taken + state->branch_not_taken;
+}
+
+// decodes the instruction at the PC into the next trace op, false if it can't be traced
+static bool loop_record_op(struct arm_state *state, struct loop_trace *t)
+{
+    struct trace_op *op;
+    unsigned int iw;
+    unsigned int pc;
+    unsigned int offset;
+    
+    if (t->n == TRACE_MAX)
+        return false;
+    
+    pc = state->regs[PC];
+    iw = *((unsigned int *) pc);
+    op = &t->ops[t->n];
+    op->pc = pc;
+    op->iw = iw;
+    op->rd = (iw >> 12) & 0xF;
+    op->rn = (iw >> 16) & 0xF;
+    op->rm = iw & 0xF;
+    op->i_bit = (iw >> 25) & 0b1;
+    
+    if (is_neon_inst(iw) || is_vfp_inst(iw) || is_bx_inst(iw)) {
+        return false;
+    } else if (is_branch_inst(iw)) {
+        if ((iw >> 24) & 0b1)
+            return false;   //bl leaves the loop body
+        offset = iw & 0xFFFFFF;
+        if ((iw >> 23) & 0b1)
+            offset = offset | 0xFF000000;
+        op->kind = TRACE_BRANCH;
+        op->target = pc + offset * 4 + 8;
+        // from the condition, a branch to the next instruction still counts as taken
+        op->taken = condition_flags(state, iw);
+    } else if (is_mul_inst(iw)) {
+        op->kind = TRACE_MUL;
+        op->rd = (iw >> 16) & 0xF;
+        op->rn = (iw >> 8) & 0xF;
+        if (op->rd == PC)
+            return false;
+    } else if (is_data_processing_inst(iw)) {
+        op->kind = TRACE_DP;
+        op->opcode = (iw >> 21) & 0xF;
+        op->imm = iw & 0xFF;
+        if ((op->rd == PC && op->opcode != 10) || op->rn == PC || (!op->i_bit && op->rm == PC))
+            return false;
+    } else if (is_single_data_transfer_inst(iw)) {
+        op->kind = TRACE_SDT;
+        op->imm = iw & 0xFFF;
+        if (op->rd == PC || op->rn == PC || (op->i_bit && op->rm == PC))
+            return false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/* Called around each interpreted instruction while a trace is recorded.
+   The trace is complete when a branch returns to the loop head. */
+static void loop_record(struct arm_state *state, struct direct_mapped_cache *cache, bool after)
+{
+    struct loop_cache *lc = state->loops;
+    struct loop_trace *t = lc->recording;
+    struct trace_op *op;
+    unsigned int comp = 0;
+    unsigned int mem = 0;
+    unsigned int taken = 0;
+    unsigned int not_taken = 0;
+    int slot;
+    int i;
+    int j;
+    
+    if (!after) {
+        if (!loop_record_op(state, t)) {
+            t->failed = true;
+            lc->recording = NULL;
+        }
+        return;
+    }
+    
+    op = &t->ops[t->n++];
+    if (state->fault != FAULT_NONE) {
+        t->failed = true;
+        lc->recording = NULL;
+        return;
+    }
+    if (state->regs[PC] != t->head || op->kind != TRACE_BRANCH)
+        return;
+    
+    // the prefix counts let a guard that fails part way through an
+    // iteration account for exactly the ops that ran
+    for (i = 0; i < t->n; i++) {
+        op = &t->ops[i];
+        op->comp = comp;
+        op->mem = mem;
+        op->taken_count = taken;
+        op->not_taken_count = not_taken;
+        if (op->kind == TRACE_BRANCH) {
+            if (op->taken)
+                taken++;
+            else
+                not_taken++;
+        } else if (op->kind == TRACE_SDT) {
+            mem++;
+        } else {
+            comp++;
+        }
+    }
+    t->comp = comp;
+    t->mem = mem;
+    t->taken = taken;
+    t->not_taken = not_taken;
+    
+    // with one body instruction per cache slot a warm cache stays warm
+    t->cache_size = cache->size;
+    t->cache_private = true;
+    for (i = 0; i < t->n; i++) {
+        slot = get_slot(t->cache_size, t->ops[i].pc);
+        for (j = 0; j < i; j++) {
+            if (get_slot(t->cache_size, t->ops[j].pc) == slot && t->ops[j].pc != t->ops[i].pc)
+                t->cache_private = false;
+        }
+    }
+    
+    t->compiled = true;
+    lc->recording = NULL;
+}
+
+// true if every instruction of the trace is already in the cache
+static bool loop_cache_warm(struct direct_mapped_cache *cache, struct loop_trace *t)
+{
+    int slot;
+    int i;
+    
+    if (!t->cache_private || cache->size != t->cache_size)
+        return false;
+    for (i = 0; i < t->n; i++) {
+        slot = get_slot(cache->size, t->ops[i].pc);
+        if (!cache->slots[slot].v || cache->slots[slot].tag != get_tag(cache->size, t->ops[i].pc))
+            return false;
+    }
+    return true;
+}
+
+// false if a load or store faulted, as armemu_single_data_transfer checks
+static bool loop_op(struct arm_state *state, struct trace_op *op)
+{
+    unsigned int iw = op->iw;
+    unsigned int rm_val;
+    unsigned int offset;
+    unsigned int base;
+    unsigned int offset_address;
+    unsigned int target_address;
+    
+    switch(op->kind)
+    {
+        case TRACE_DP:
+            rm_val = op->i_bit ? op->imm : state->regs[op->rm];
+            switch(op->opcode)
+            {
+                case 2: //sub
+                    state->regs[op->rd] = state->regs[op->rn] - rm_val;
+                    break;
+                case 4: //add
+                    state->regs[op->rd] = state->regs[op->rn] + rm_val;
+                    break;
+                case 10: //cmp
+                    set_cpsr_flags(state, state->regs[op->rn], rm_val);
+                    break;
+                case 13: //mov
+                    state->regs[op->rd] = rm_val;
+                    break;
+            }
+            break;
+        case TRACE_MUL:
+            state->regs[op->rd] = state->regs[op->rm] * state->regs[op->rn];
+            break;
+        case TRACE_SDT:
+            // same addressing as armemu_single_data_transfer
+            offset = op->i_bit ? state->regs[op->rm] : op->imm;
+            base = state->regs[op->rn];
+            offset_address = ((iw >> 23) & 0b1) ? base + offset : base - offset;
+            target_address = ((iw >> 24) & 0b1) ? offset_address : base;
+            if (!check_address(state, target_address, ((iw >> 22) & 0b1) ? 1 : 4))
+                return false;
+            if (!((iw >> 24) & 0b1) || ((iw >> 21) & 0b1))
+                state->regs[op->rn] = offset_address;
+            if ((iw >> 22) & 0b1) {
+                if ((iw >> 20) & 0b1) {
+                    state->regs[op->rd] = *((unsigned char *) target_address);
+                } else {
+                    *((unsigned char *) target_address) = state->regs[op->rd];
+                    stack_store(state, target_address);
+                }
+            } else if ((iw >> 20) & 0b1) {
+                state->regs[op->rd] = *((unsigned int *) target_address);
+            } else {
+                *((unsigned int *) target_address) = state->regs[op->rd];
+                stack_store(state, target_address);
+            }
+            break;
+    }
+    return true;
+}
+
+/* Runs a compiled loop from its head until a guard fails. Decoding, counter
+   updates and, when the body's cache slots are warm, the cache simulation
+   are hoisted out of the iterations; the counters and cache statistics end
+   up exactly as if every instruction had been interpreted. */
+static void loop_run(struct arm_state *state, struct direct_mapped_cache *cache, struct loop_trace *t)
+{
+    struct trace_op *op;
+    bool warm;
+    bool taken;
+    int i;
+    
+    t->entries++;
+    for (;;) {
+        warm = loop_cache_warm(cache, t);
+        for (i = 0; i < t->n; i++) {
+            op = &t->ops[i];
+            if (!warm)
+                simulate_cache(cache, op->pc);
+            if (op->kind != TRACE_BRANCH) {
+                if (loop_op(state, op))
+                    continue;
+                // a faulting load or store stops where the interpreter would
+                state->computation_count += op->comp;
+                state->memory_count += op->mem;
+                state->memory_words += op->mem;
+                state->branch_taken += op->taken_count;
+                state->branch_not_taken += op->not_taken_count;
+                if (warm) {
+                    cache->requests += i + 1;
+                    cache->cache_hit += i + 1;
+                }
+                state->regs[PC] = op->pc;
+                return;
+            }
+            taken = condition_flags(state, op->iw);
+            if (taken != op->taken) {
+                // guard failed, leave with the counts of the ops that ran
+                state->computation_count += op->comp;
+                state->memory_count += op->mem;
+                state->memory_words += op->mem;
+                state->branch_taken += op->taken_count;
+                state->branch_not_taken += op->not_taken_count;
+                if (taken)
+                    state->branch_taken++;
+                else
+                    state->branch_not_taken++;
+                if (warm) {
+                    cache->requests += i + 1;
+                    cache->cache_hit += i + 1;
+                }
+                state->regs[PC] = taken ? op->target : op->pc + 4;
+                
+                // a loop that keeps leaving in its first iteration is not stable
+                if (t->entries > LOOP_HOT && t->iterations < t->entries)
+                    t->failed = true;
+                return;
+            }
+        }
+        state->computation_count += t->comp;
+        state->memory_count += t->mem;
+        state->memory_words += t->mem;
+        state->branch_taken += t->taken;
+        state->branch_not_taken += t->not_taken;
+        if (warm) {
+            cache->requests += t->n;
+            cache->cache_hit += t->n;
+        }
+        t->iterations++;
+        
+        if ((state->budget != 0 && instruction_total(state) >= state->budget)
+            || (state->slice != 0 && instruction_total(state) >= state->slice_end)) {
+            state->regs[PC] = t->head;
+            return;
+        }
+    }
+}
+
+/* Superinstructions: runs of two or three instructions that a profile of
+   the workloads showed to be common (cmp and a conditional branch, ldrb
+   and cmp, add and b) run as one dispatch. armsuper generates a handler
+   for each run in armsuper_gen.c; the handlers are built from the
+   functions below and update the counters and the cache simulation per
+   instruction, exactly as armemu_one would. */
+
+int super_opcode(unsigned int iw)
+{
+    switch(classify_inst(iw))
+    {
+        case INST_NEON:
+            return SOP_NEON;
+        case INST_VFP:
+            return SOP_VFP;
+        case INST_BX:
+            return SOP_BX;
+        case INST_BRANCH:
+            if ((iw >> 24) & 0b1)
+                return SOP_BL;
+            if ((iw >> 28) == 14)
+                return SOP_B;
+            if ((iw >> 28) == 15)
+                return SOP_UNDEFINED;
+            return SOP_BEQ + (iw >> 28);
+        case INST_MUL:
+            return SOP_MUL;
+        case INST_DATA_PROCESSING:
+            switch((iw >> 21) & 0xF)
+            {
+                case 2:
+                    return SOP_SUB;
+                case 4:
+                    return SOP_ADD;
+                case 10:
+                    return SOP_CMP;
+                case 13:
+                    return SOP_MOV;
+            }
+            return SOP_DP;
+        case INST_SINGLE_DATA_TRANSFER:
+            if ((iw >> 22) & 0b1)
+                return ((iw >> 20) & 0b1) ? SOP_LDRB : SOP_STRB;
+            return ((iw >> 20) & 0b1) ? SOP_LDR : SOP_STR;
+        case INST_BLOCK_DATA_TRANSFER:
+            return ((iw >> 20) & 0b1) ? SOP_LDM : SOP_STM;
+    }
+    return SOP_UNDEFINED;
+}
+
+// counts the instruction at pc with the one or two before it, if they ran in sequence
+static void super_profile_count(struct super_profile *p, unsigned int pc)
+{
+    int op = super_opcode(*((unsigned int *) pc));
+    
+    if (p->prev_pc[0] + 4 == pc) {
+        p->pairs[p->prev_op[0]][op]++;
+        if (p->prev_pc[1] + 8 == pc)
+            p->triples[p->prev_op[1]][p->prev_op[0]][op]++;
+    }
+    p->prev_pc[1] = p->prev_pc[0];
+    p->prev_op[1] = p->prev_op[0];
+    p->prev_pc[0] = pc;
+    p->prev_op[0] = op;
+}
+
+// decodes the instruction at pc, false if it can't be part of a superinstruction
+static bool super_predecode(unsigned int pc, struct super_op *op)
+{
+    unsigned int iw = *((unsigned int *) pc);
+    unsigned int offset;
+    
+    op->iw = iw;
+    op->opcode = super_opcode(iw);
+    op->rd = (iw >> 12) & 0xF;
+    op->rn = (iw >> 16) & 0xF;
+    op->rm = iw & 0xF;
+    op->i_bit = (iw >> 25) & 0b1;
+    
+    // the same restrictions as loop traces, nothing but a branch writes pc
+    switch(op->opcode)
+    {
+        case SOP_SUB:
+        case SOP_ADD:
+        case SOP_CMP:
+        case SOP_MOV:
+        case SOP_DP:
+            op->imm = iw & 0xFF;
+            return !((op->rd == PC && op->opcode != SOP_CMP) || op->rn == PC || (!op->i_bit && op->rm == PC));
+        case SOP_MUL:
+            op->rd = (iw >> 16) & 0xF;
+            op->rn = (iw >> 8) & 0xF;
+            return op->rd != PC;
+        case SOP_LDR:
+        case SOP_STR:
+        case SOP_LDRB:
+        case SOP_STRB:
+            op->imm = iw & 0xFFF;
+            return !(op->rd == PC || op->rn == PC || (op->i_bit && op->rm == PC));
+        case SOP_B:
+            break;
+        default:
+            if (op->opcode < SOP_BEQ || op->opcode > SOP_B)
+                return false;
+    }
+    offset = iw & 0xFFFFFF;
+    if ((iw >> 23) & 0b1)
+        offset = offset | 0xFF000000;
+    op->target = pc + offset * 4 + 8;
+    return true;
+}
+
+// ldr, str, ldrb or strb, false if it faulted
+static bool super_sdt(struct arm_state *state, struct super_op *op)
+{
+    unsigned int iw = op->iw;
+    unsigned int offset;
+    unsigned int base;
+    unsigned int offset_address;
+    unsigned int target_address;
+    unsigned int len = ((iw >> 22) & 0b1) ? 1 : 4;
+    
+    // same addressing as armemu_single_data_transfer
+    offset = op->i_bit ? state->regs[op->rm] : op->imm;
+    base = state->regs[op->rn];
+    offset_address = ((iw >> 23) & 0b1) ? base + offset : base - offset;
+    target_address = ((iw >> 24) & 0b1) ? offset_address : base;
+    if (!check_address(state, target_address, len))
+        return false;
+    memo_access(state, target_address, len, op->opcode == SOP_STR || op->opcode == SOP_STRB);
+    if (!((iw >> 24) & 0b1) || ((iw >> 21) & 0b1))
+        state->regs[op->rn] = offset_address;
+    
+    switch(op->opcode)
+    {
+        case SOP_LDR:
+            state->regs[op->rd] = *((unsigned int *) target_address);
+            break;
+        case SOP_STR:
+            *((unsigned int *) target_address) = state->regs[op->rd];
+            stack_store(state, target_address);
+            break;
+        case SOP_LDRB:
+            state->regs[op->rd] = *((unsigned char *) target_address);
+            break;
+        case SOP_STRB:
+            *((unsigned char *) target_address) = state->regs[op->rd];
+            stack_store(state, target_address);
+            break;
+    }
+    state->memory_count++;
+    state->memory_words++;
+    state->regs[PC] = state->regs[PC] + 4;
+    return true;
+}
+
+// the second operand of a data processing instruction
+static unsigned int super_operand(struct arm_state *state, struct super_op *op)
+{
+    return op->i_bit ? op->imm : state->regs[op->rm];
+}
+
+// the last instruction of a superinstruction, its condition already evaluated
+static void super_branch(struct arm_state *state, struct super_op *op, bool taken)
+{
+    if (taken) {
+        state->branch_taken++;
+        state->regs[PC] = op->target;
+    } else {
+        state->branch_not_taken++;
+        state->regs[PC] = state->regs[PC] + 4;
+    }
+    coverage_edge(state, state->regs[PC]);
+}
+
+struct super_pattern {
+    int n;
+    unsigned char opcodes[SUPER_MAX];
+    void (*run)(struct arm_state *state, struct direct_mapped_cache *cache, struct super_op *ops);
+};
+
+#include "armsuper_gen.c"
+
+// superinstructions generated into armsuper_gen.c
+int armemu_super_patterns(void)
+{
+    return super_npatterns;
+}
+
+// fills a slot with the longest superinstruction starting at pc, if any
+static void super_decode(struct arm_state *state, struct super_slot *slot, unsigned int pc)
+{
+    const struct super_pattern *p;
+    int n;
+    int i;
+    int k;
+    
+    slot->pc = pc;
+    slot->pattern = -1;
+    // only a branch ends a run, so no word after the end of a function is read
+    for (n = 0; n < SUPER_MAX; n++) {
+        if (state->check_mem && pc + 4 * n + 4 > state->code_hi)
+            break;
+        if (!super_predecode(pc + 4 * n, &slot->ops[n]))
+            break;
+        if (slot->ops[n].opcode >= SOP_BEQ && slot->ops[n].opcode <= SOP_B) {
+            n++;
+            break;
+        }
+    }
+    // patterns are generated longest first
+    for (i = 0; i < super_npatterns; i++) {
+        p = &super_patterns[i];
+        for (k = 0; k < p->n && k < n && p->opcodes[k] == slot->ops[k].opcode; k++)
+            ;
+        if (k == p->n) {
+            slot->pattern = i;
+            return;
+        }
+    }
+}
+
+/* Runs a superinstruction or a single instruction, returning the address
+   after it so armemu() can tell whether it branched */
+static unsigned int super_dispatch(struct arm_state *state, struct direct_mapped_cache *cache)
+{
+    struct super_cache *sc = state->super;
+    unsigned int pc = state->regs[PC];
+    struct super_slot *slot = &sc->slots[(pc >> 2) % SUPER_SLOTS];
+    const struct super_pattern *p;
+    
+    sc->dispatches++;
+    if (slot->pc != pc)
+        super_decode(state, slot, pc);
+    if (slot->pattern < 0) {
+        armemu_one(state, cache);
+        return pc + 4;
+    }
+    p = &super_patterns[slot->pattern];
+    p->run(state, cache, slot->ops);
+    sc->fused += p->n;
+    return pc + 4 * p->n;
+}
+
+static void memo_counts_read(struct arm_state *state, struct direct_mapped_cache *cache, struct memo_counts *c)
+{
+    c->comp = state->computation_count;
+    c->mem = state->memory_count;
+    c->mem_words = state->memory_words;
+    c->taken = state->branch_taken;
+    c->not_taken = state->branch_not_taken;
+    c->cache_requests = cache->requests;
+    c->cache_hits = cache->cache_hit;
+    c->cache_misses = cache->cache_miss;
+}
+
+static struct memo_entry *memo_lookup(struct memo_cache *mc, unsigned int target, unsigned int *args)
+{
+    unsigned int h = target;
+    int i;
+    
+    for (i = 0; i < 4; i++) {
+        h = (h ^ args[i]) * 0x9E3779B1;
+    }
+    return &mc->entries[(h ^ (h >> 16)) % MEMO_SLOTS];
+}
+
+/* At a taken bl, with PC at the callee and LR at the return address.
+   A recorded call with the same target, r0-r3 and read words is skipped:
+   the registers it changed and its counts are applied as if it ran.
+   Otherwise the call is recorded. A call that read the stack above its
+   frame, such as arguments past r3, only matches at the same sp, since
+   the same addresses at another sp are other slots. */
+static void memo_call(struct arm_state *state, struct direct_mapped_cache *cache)
+{
+    struct memo_cache *mc = state->memo;
+    struct memo_entry *e;
+    struct memo_frame *f;
+    int i;
+    
+    mc->called = false;
+    // traces and translated code don't report their memory accesses
+    if (state->loops != NULL || state->aot != NULL)
+        return;
+    mc->calls++;
+    
+    e = memo_lookup(mc, state->regs[PC], state->regs);
+    if (e->valid && e->target == state->regs[PC] && memcmp(e->args, state->regs, sizeof(e->args)) == 0
+        && (!e->reads_stack || e->sp == state->regs[SP])) {
+        for (i = 0; i < e->nreads && *((unsigned int *) e->read_addr[i]) == e->read_val[i]; i++)
+            ;
+        if (i == e->nreads) {
+            for (i = 0; i < e->nreads; i++) {
+                memo_read(state, e->read_addr[i], e->read_val[i]);
+            }
+            memcpy(state->regs, e->out, sizeof(e->out));
+            state->regs[12] = e->r12;
+            state->regs[PC] = state->regs[LR];
+            if (!e->lr_is_return)
+                state->regs[LR] = e->lr;
+            state->n_flag = e->flags[0];
+            state->z_flag = e->flags[1];
+            state->c_flag = e->flags[2];
+            state->v_flag = e->flags[3];
+            state->computation_count += e->delta.comp;
+            state->memory_count += e->delta.mem;
+            state->memory_words += e->delta.mem_words;
+            state->branch_taken += e->delta.taken;
+            state->branch_not_taken += e->delta.not_taken;
+            cache->requests += e->delta.cache_requests;
+            cache->cache_hit += e->delta.cache_hits;
+            cache->cache_miss += e->delta.cache_misses;
+            mc->hits++;
+            return;
+        }
+    }
+    
+    if (mc->depth == MEMO_DEPTH)
+        return;
+    f = &mc->frames[mc->depth++];
+    f->target = state->regs[PC];
+    f->sp = state->regs[SP];
+    f->lr = state->regs[LR];
+    memcpy(f->regs, state->regs, sizeof(f->regs));
+    f->pure = true;
+    f->nreads = 0;
+    memo_counts_read(state, cache, &f->start);
+}
+
+/* The innermost recorded call returned. It is kept if it was pure and, as
+   the calling convention requires, left r4-r11 as they were. */
+static void memo_return(struct arm_state *state, struct direct_mapped_cache *cache)
+{
+    struct memo_cache *mc = state->memo;
+    struct memo_frame *f = &mc->frames[--mc->depth];
+    struct memo_entry *e;
+    struct memo_counts end;
+    int i;
+    
+    if (!f->pure || memcmp(&f->regs[4], &state->regs[4], 8 * sizeof(unsigned int)) != 0) {
+        mc->impure++;
+        return;
+    }
+    
+    e = memo_lookup(mc, f->target, f->regs);
+    e->valid = true;
+    e->target = f->target;
+    memcpy(e->args, f->regs, sizeof(e->args));
+    e->sp = f->sp;
+    e->reads_stack = false;
+    for (i = 0; i < f->nreads; i++) {
+        if (f->read_addr[i] >= (unsigned int) state->stack && f->read_addr[i] < (unsigned int) &state->stack[state->stack_size])
+            e->reads_stack = true;
+    }
+    e->nreads = f->nreads;
+    memcpy(e->read_addr, f->read_addr, f->nreads * sizeof(unsigned int));
+    memcpy(e->read_val, f->read_val, f->nreads * sizeof(unsigned int));
+    memcpy(e->out, state->regs, sizeof(e->out));
+    e->r12 = state->regs[12];
+    e->lr = state->regs[LR];
+    e->lr_is_return = state->regs[LR] == f->lr;
+    e->flags[0] = state->n_flag;
+    e->flags[1] = state->z_flag;
+    e->flags[2] = state->c_flag;
+    e->flags[3] = state->v_flag;
+    
+    memo_counts_read(state, cache, &end);
+    e->delta.comp = end.comp - f->start.comp;
+    e->delta.mem = end.mem - f->start.mem;
+    e->delta.mem_words = end.mem_words - f->start.mem_words;
+    e->delta.taken = end.taken - f->start.taken;
+    e->delta.not_taken = end.not_taken - f->start.not_taken;
+    e->delta.cache_requests = end.cache_requests - f->start.cache_requests;
+    e->delta.cache_hits = end.cache_hits - f->start.cache_hits;
+    e->delta.cache_misses = end.cache_misses - f->start.cache_misses;
+    mc->recorded++;
+}
+
+/* Loads an object generated by armaot and resolves its entry points to
+   guest addresses. armemu is linked with -rdynamic so the guest symbols
+   can be looked up by name. */
+bool aot_load(struct aot_code *aot, char *path)
+{
+    void *handle;
+    struct aot_entry *table;
+    int *size;
+    void *sym;
+    unsigned int h;
+    int i;
+    
+    aot->handle = NULL;
+    aot->n = 0;
+    memset(aot->hash, 0, sizeof(aot->hash));
+    handle = dlopen(path, RTLD_NOW);
+    if (handle == NULL)
+        return false;
+    table = dlsym(handle, "aot_table");
+    size = dlsym(handle, "aot_table_size");
+    if (table == NULL || size == NULL) {
+        dlclose(handle);
+        return false;
+    }
+    aot->handle = handle;
+    
+    for (i = 0; i < *size && aot->n < AOT_MAX_ENTRIES; i++) {
+        sym = dlsym(RTLD_DEFAULT, table[i].name);
+        if (sym == NULL)
+            continue;
+        aot->addr[aot->n] = (unsigned int) sym + table[i].offset;
+        aot->fn[aot->n] = table[i].fn;
+        for (h = (aot->addr[aot->n] >> 2) & (AOT_HASH_SIZE - 1); aot->hash[h] != 0; h = (h + 1) & (AOT_HASH_SIZE - 1))
+            ;
+        aot->hash[h] = aot->n + 1;
+        aot->n++;
+    }
+    return true;
+}
+
+// closes the object aot_load opened; no machine may still point at aot
+void aot_unload(struct aot_code *aot)
+{
+    if (aot->handle != NULL)
+        dlclose(aot->handle);
+    aot->handle = NULL;
+    aot->n = 0;
+    memset(aot->hash, 0, sizeof(aot->hash));
+}
+
+// index of the entry point at addr, -1 if there is none
+static int aot_lookup(struct aot_code *aot, unsigned int addr)
+{
+    unsigned int h;
+    
+    for (h = (addr >> 2) & (AOT_HASH_SIZE - 1); aot->hash[h] != 0; h = (h + 1) & (AOT_HASH_SIZE - 1)) {
+        if (aot->addr[aot->hash[h] - 1] == addr)
+            return aot->hash[h] - 1;
+    }
+    return -1;
+}
+
+// runs translated code if the PC is at a translated entry point
+static bool aot_enter(struct arm_state *state)
+{
+    unsigned int counts[AOT_NCOUNTS];
+    int flags[4];
+    int i;
+    
+    i = aot_lookup(state->aot, state->regs[PC]);
+    if (i < 0)
+        return false;
+    // memoization can't see the loads and stores of translated code
+    memo_discard(state);
+    
+    flags[0] = state->n_flag;
+    flags[1] = state->z_flag;
+    flags[2] = state->c_flag;
+    flags[3] = state->v_flag;
+    memset(counts, 0, sizeof(counts));
+    
+    state->aot->fn[i](state->regs, flags, counts);
+    
+    state->n_flag = flags[0];
+    state->z_flag = flags[1];
+    state->c_flag = flags[2];
+    state->v_flag = flags[3];
+    state->computation_count += counts[AOT_COMPUTATION];
+    state->memory_count += counts[AOT_MEMORY];
+    state->memory_words += counts[AOT_MEMORY_WORDS];
+    state->branch_taken += counts[AOT_BRANCH_TAKEN];
+    state->branch_not_taken += counts[AOT_BRANCH_NOT_TAKEN];
+    return true;
+}
+
+/* Creates the shared memory segment armmon reads, NULL on failure */
+struct telemetry *telemetry_create(char *name)
+{
+    struct telemetry *t;
+    int fd;
+    
+    // never attach to another writer's segment, the seqlock has one writer
+    fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0)
+        return NULL;
+    // the name is ours from here on, so every failure removes it again
+    if (ftruncate(fd, sizeof(struct telem_segment)) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    t = malloc(sizeof(struct telemetry));
+    if (t == NULL) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    t->seg = mmap(NULL, sizeof(struct telem_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (t->seg == MAP_FAILED) {
+        free(t);
+        shm_unlink(name);
+        return NULL;
+    }
+    memset(&t->done, 0, sizeof(t->done));
+    memset((void *) t->seg, 0, sizeof(struct telem_segment));
+    t->seg->pid = getpid();
+    return t;
+}
+
+void telemetry_destroy(struct telemetry *t, char *name)
+{
+    t->seg->pid = 0;
+    munmap((void *) t->seg, sizeof(struct telem_segment));
+    shm_unlink(name);
+    free(t);
+}
+
+/* Copies counters into the segment. Plain stores and two fences, the
+   only writer never needs an atomic. */
+static void telemetry_write(struct telemetry *t, struct telem_counters *c)
+{
+    struct telem_segment *seg = t->seg;
+    struct timespec now;
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    
+    seg->seq = seg->seq + 1;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    seg->c.computation = c->computation;
+    seg->c.memory = c->memory;
+    seg->c.memory_words = c->memory_words;
+    seg->c.branch_taken = c->branch_taken;
+    seg->c.branch_not_taken = c->branch_not_taken;
+    seg->c.cache_requests = c->cache_requests;
+    seg->c.cache_hits = c->cache_hits;
+    seg->c.cache_misses = c->cache_misses;
+    seg->c.runs = c->runs;
+    seg->c.time_ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    seg->seq = seg->seq + 1;
+}
+
+/* Adds the counters of a run so far to the finished totals */
+static void telemetry_add(struct telem_counters *c, struct arm_state *state, struct direct_mapped_cache *cache)
+{
+    c->computation += state->computation_count;
+    c->memory += state->memory_count;
+    c->memory_words += state->memory_words;
+    c->branch_taken += state->branch_taken;
+    c->branch_not_taken += state->branch_not_taken;
+    c->cache_requests += cache->requests;
+    c->cache_hits += cache->cache_hit;
+    c->cache_misses += cache->cache_miss;
+}
+
+/* Publishes the finished totals plus the running state's counters */
+void telemetry_publish(struct telemetry *t, struct arm_state *state, struct direct_mapped_cache *cache)
+{
+    struct telem_counters c = t->done;
+    
+    telemetry_add(&c, state, cache);
+    telemetry_write(t, &c);
+}
+
+/* Folds a finished run into the totals and publishes them */
+static void telemetry_finish(struct telemetry *t, struct arm_state *state, struct direct_mapped_cache *cache)
+{
+    telemetry_add(&t->done, state, cache);
+    t->done.runs++;
+    telemetry_write(t, &t->done);
+}
+
+unsigned int armemu(struct arm_state *state, struct direct_mapped_cache *cache)
+{
+    unsigned int pc;
+    unsigned int next;
+    
+    // a run that yielded carries on where it stopped
+    if (state->fault == FAULT_YIELD)
+        state->fault = FAULT_NONE;
+    if (state->slice != 0)
+        state->slice_end = instruction_total(state) + state->slice;
+    
+    //Execute instructions until PC = 0
+    //This happens when bx lr is issued and lr is 0
+    while (state->regs[PC] != 0) {
+        if (state->check_mem && (state->regs[PC] < state->code_lo || state->regs[PC] >= state->code_hi)) {
+            state->fault = FAULT_MEMORY;
+            break;
+        }
+        if (state->budget != 0 && instruction_total(state) >= state->budget) {
+            state->fault = FAULT_HANG;
+            break;
+        }
+        pc = state->regs[PC];
+        next = pc + 4;
+        if (state->profile != NULL && (state->loops == NULL || state->loops->pending == NULL))
+            super_profile_count(state->profile, pc);
+        // translated code runs a whole function, so it can't honour a slice
+        if (state->aot != NULL && state->slice == 0 && aot_enter(state)) {
+            next = 0;
+        } else if (state->loops != NULL && state->loops->pending != NULL) {
+            // a trace stops after an iteration once the slice or budget is used up
+            loop_run(state, cache, state->loops->pending);
+            state->loops->pending = NULL;
+            next = 0;
+        } else if (state->loops != NULL && state->loops->recording != NULL) {
+            loop_record(state, cache, false);
+            armemu_one(state, cache);
+            if (state->loops->recording != NULL)
+                loop_record(state, cache, true);
+        } else if (state->super != NULL && state->loops == NULL) {
+            // loop traces are found by armemu_branch, which superinstructions bypass
+            next = super_dispatch(state, cache);
+        } else {
+            armemu_one(state, cache);
+        }
+        if (state->fault != FAULT_NONE)
+            break;
+        if (state->memo != NULL) {
+            if (state->memo->depth > 0 && state->regs[PC] == state->memo->frames[state->memo->depth - 1].lr
+                && state->regs[SP] == state->memo->frames[state->memo->depth - 1].sp)
+                memo_return(state, cache);
+            else if (state->memo->called)
+                memo_call(state, cache);
+        }
+        if (state->telem != NULL && --state->telem_countdown == 0) {
+            state->telem_countdown = TELEM_INTERVAL;
+            telemetry_publish(state->telem, state, cache);
+        }
+        // preemption point, only where a block ended in a taken branch or a trace
+        if (state->slice != 0 && state->regs[PC] != next && instruction_total(state) >= state->slice_end) {
+            state->fault = FAULT_YIELD;
+            break;
+        }
+    }
+    if (state->telem != NULL && state->fault != FAULT_YIELD)
+        telemetry_finish(state->telem, state, cache);
+    return state->regs[0];
+}
+
+/* A region machines are carved from. It is backed by huge pages when the
+   system has them reserved, so thousands of small machines share a few
+   TLB entries. Destroyed machines go on a free list and are reused by
+   machines with the same layout. */
+struct armemu_arena {
+    char *base;
+    size_t size;
+    size_t used;
+    bool huge;                      // MAP_HUGETLB pages, which can't hold guard pages
+    struct armemu_machine *free;
+};
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+void armemu_config_default(struct armemu_config *config)
+{
+    config->stack_size = STACK_SIZE;
+    config->cache_size = 8;
+    config->guard_page = false;
+    config->budget = 0;
+    config->check_mem = false;
+    config->code_lo = 0;
+    config->code_hi = 0;
+}
+
+/* Reserves size bytes for machines. With huge set it tries huge pages
+   first and falls back to normal pages with transparent huge pages
+   requested. NULL on failure. */
+struct armemu_arena *armemu_arena_create(size_t size, bool huge)
+{
+    struct armemu_arena *arena;
+    size_t page = sysconf(_SC_PAGESIZE);
+    void *base = MAP_FAILED;
+    
+    arena = malloc(sizeof(struct armemu_arena));
+    if (arena == NULL)
+        return NULL;
+    
+    arena->huge = false;
+    if (huge) {
+        arena->size = (size + HUGE_PAGE_SIZE - 1) & ~(size_t) (HUGE_PAGE_SIZE - 1);
+        base = mmap(NULL, arena->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        arena->huge = (base != MAP_FAILED);
+    }
+    if (base == MAP_FAILED) {
+        arena->size = (size + page - 1) & ~(page - 1);
+        base = mmap(NULL, arena->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED) {
+            free(arena);
+            return NULL;
+        }
+        if (huge)
+            madvise(base, arena->size, MADV_HUGEPAGE);
+    }
+    
+    arena->base = base;
+    arena->used = 0;
+    arena->free = NULL;
+    return arena;
+}
+
+bool armemu_arena_huge(struct armemu_arena *arena)
+{
+    return arena->huge;
+}
+
+size_t armemu_arena_used(struct armemu_arena *arena)
+{
+    return arena->used;
+}
+
+/* Frees the arena and every machine still in it */
+void armemu_arena_destroy(struct armemu_arena *arena)
+{
+    munmap(arena->base, arena->size);
+    free(arena);
+}
+
+// get_slot masks with size - 1, so the cache must have a power of 2 slots
+static bool cache_size_valid(int size)
+{
+    return size > 0 && (size & (size - 1)) == 0;
+}
+
+/* Creates a machine laid out as [guard page][stack][machine][cache slots]
+   [dirty slots], in the arena or, with a NULL arena, in a mapping of its
+   own. The stack grows down towards the guard page, so an overflow faults
+   on the host instead of writing into the neighbouring machine. Guard
+   pages split the mapping, so creation fails with ENOMEM once the
+   process reaches vm.max_map_count mappings. NULL on failure. */
+struct armemu_machine *armemu_create(struct armemu_arena *arena, struct armemu_config *config)
+{
+    struct armemu_machine *m;
+    struct armemu_machine **prev;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t guard = config->guard_page ? page : 0;
+    size_t stack = (config->stack_size + 15) & ~(size_t) 15;
+    size_t align = config->guard_page ? page : 64;
+    size_t size;
+    size_t offset;
+    char *block = NULL;
+    
+    if (stack == 0 || !cache_size_valid(config->cache_size)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    size = guard + stack + sizeof(struct armemu_machine) + config->cache_size * (sizeof(struct cache_slot) + sizeof(int));
+    size = (size + align - 1) & ~(align - 1);
+    
+    if (arena == NULL) {
+        block = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (block == MAP_FAILED)
+            return NULL;
+        if (guard != 0 && mprotect(block, guard, PROT_NONE) != 0) {
+            munmap(block, size);
+            return NULL;
+        }
+    } else {
+        if (arena->huge && guard != 0) {
+            errno = EINVAL;
+            return NULL;
+        }
+        for (prev = &arena->free; *prev != NULL; prev = &(*prev)->next) {
+            if ((*prev)->block_size == size && (*prev)->guard_page == config->guard_page)
+                break;
+        }
+        if (*prev != NULL) {
+            // reuse a destroyed machine, only the part of its stack it wrote is dirty
+            m = *prev;
+            *prev = m->next;
+            block = m->block;
+            memset((void *) m->state.stack_low, 0, (unsigned int) m - m->state.stack_low);
+            memset(m, 0, size - guard - stack);
+        } else {
+            offset = (arena->used + align - 1) & ~(align - 1);
+            if (offset + size > arena->size) {
+                errno = ENOMEM;
+                return NULL;
+            }
+            block = arena->base + offset;
+            if (guard != 0 && mprotect(block, guard, PROT_NONE) != 0)
+                return NULL;
+            arena->used = offset + size;
+        }
+    }
+    
+    // the memory is zero, so only what isn't zero after arm_state_init is set
+    m = (struct armemu_machine *) (block + guard + stack);
+    m->arena = arena;
+    m->block = block;
+    m->block_size = size;
+    m->guard_page = config->guard_page;
+    m->state.stack = (unsigned char *) block + guard;
+    m->state.stack_size = stack;
+    m->state.regs[SP] = (unsigned int) m;
+    m->state.stack_low = (unsigned int) m;
+    m->state.telem_countdown = TELEM_INTERVAL;
+    m->cache.slots = (struct cache_slot *) (m + 1);
+    m->cache.dirty = (int *) (m->cache.slots + config->cache_size);
+    m->cache.capacity = config->cache_size;
+    armemu_configure(m, config);
+    return m;
+}
+
+/* Changes the cache size, budget and memory checks between runs. The stack
+   and guard page can't change, and the cache can't grow past the size the
+   machine was created with. */
+bool armemu_configure(struct armemu_machine *m, struct armemu_config *config)
+{
+    int i;
+    
+    if (((config->stack_size + 15) & ~15) != m->state.stack_size || config->guard_page != m->guard_page)
+        return false;
+    if (!cache_size_valid(config->cache_size) || config->cache_size > m->cache.capacity)
+        return false;
+    
+    if (config->cache_size != m->cache.size) {
+        for (i = 0; i < m->cache.capacity; i++) {
+            m->cache.slots[i].v = 0;
+            m->cache.slots[i].tag = 0;
+        }
+        m->cache.ndirty = 0;
+        m->cache.size = config->cache_size;
+    }
+    m->state.budget = config->budget;
+    m->state.check_mem = config->check_mem;
+    m->state.code_lo = config->code_lo;
+    m->state.code_hi = config->code_hi;
+    return true;
+}
+
+/* Runs func with four arguments from a clean machine and returns r0. Only
+   what the previous run dirtied is cleared first. armemu_query has the
+   fault and counters. */
+unsigned int armemu_run(struct armemu_machine *m, unsigned int *func, unsigned int arg0, unsigned int arg1, unsigned int arg2, unsigned int arg3)
+{
+    armemu_start(m, func, arg0, arg1, arg2, arg3);
+    return armemu(&m->state, &m->cache);
+}
+
+/* Sets up a run of func like armemu_run without running it, for the
+   scheduler or for a caller that runs it with armemu() in time slices */
+void armemu_start(struct armemu_machine *m, unsigned int *func, unsigned int arg0, unsigned int arg1, unsigned int arg2, unsigned int arg3)
+{
+    arm_state_reset(&m->state, &m->cache, func, arg0, arg1, arg2, arg3);
+}
+
+void armemu_query(struct armemu_machine *m, struct armemu_stats *stats)
+{
+    stats->result = m->state.regs[0];
+    stats->fault = m->state.fault;
+    stats->computation = m->state.computation_count;
+    stats->memory = m->state.memory_count;
+    stats->memory_words = m->state.memory_words;
+    stats->branch_taken = m->state.branch_taken;
+    stats->branch_not_taken = m->state.branch_not_taken;
+    stats->cache_requests = m->cache.requests;
+    stats->cache_hits = m->cache.cache_hit;
+    stats->cache_misses = m->cache.cache_miss;
+    stats->stack_used = (unsigned int) m - m->state.stack_low;
+}
+
+void armemu_destroy(struct armemu_machine *m)
+{
+    if (m->arena == NULL) {
+        munmap(m->block, m->block_size);
+        return;
+    }
+    m->next = m->arena->free;
+    m->arena->free = m;
+}